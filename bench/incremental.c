@@ -0,0 +1,301 @@
+/* Latency benchmark for the incremental re-parse (Session).
+ * Generates a program of LINES statements, applies EDITS random edits to it
+ * through a session and reports the time each took next to a full parse of
+ * the same file. At the end the session AST and its codegen output are
+ * checked against a full parse of the final text, so the edits are also a
+ * correctness test. Some edits break a line and fix it with the next one,
+ * the parser reports those on stderr.
+ *
+ *     gcc -std=c99 -D_DEFAULT_SOURCE -pthread -O2 -o ./incremental_bench \
+ *         ./bench/incremental.c ./src/ast.c ./src/ast_cache.c \
+ *         ./src/codegen_x86_64.c ./src/emit.c ./src/ir.c ./src/jit.c \
+ *         ./src/object.c ./src/scanner.c ./src/session.c ./src/simd.c \
+ *         ./src/string_pool.c ./src/tokenizer.c ./src/utils.c
+ *     ./incremental_bench [LINES] [EDITS]
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/ast.h"
+#include "../src/codegen.h"
+#include "../src/session.h"
+#include "../src/string_pool.h"
+#include "../src/tokenizer.h"
+#include "../src/utils.h"
+
+#define SRC_FILE "/tmp/carmen_incremental.carmen"
+
+// the text the session should have, edited the same way
+typedef struct Text_s {
+    char* data;
+    size_t len;
+    size_t cap;
+} Text;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+static uint32_t bench_rand(uint32_t* seed) // xorshift32
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+static int cmp_double(const void* a, const void* b)
+{
+    const double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void text_edit(
+    Text* text, size_t offset, size_t deleted, const char* str, size_t len)
+{
+    const size_t new_len = text->len - deleted + len;
+    if ( text->cap < new_len + 1 ) {
+        text->cap = (new_len + 1) * 2;
+        text->data = realloc(text->data, text->cap);
+        if ( text->data == NULL ) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    memmove(&text->data[offset + len], &text->data[offset + deleted],
+        text->len - offset - deleted);
+    memcpy(&text->data[offset], str, len);
+    text->len = new_len;
+    text->data[new_len] = '\0';
+}
+static void text_write(const Text* text, const char* file_name)
+{
+    FILE* out = fopen(file_name, "w");
+    if ( out == NULL || fwrite(text->data, 1, text->len, out) != text->len ) {
+        perror(file_name);
+        exit(1);
+    }
+    fclose(out);
+}
+// start of the line of a random offset
+static size_t text_line(const Text* text, uint32_t* seed)
+{
+    size_t p = bench_rand(seed) % (text->len + 1);
+    while ( 0 < p && text->data[p - 1] != '\n' ) { p--; }
+    return p;
+}
+static size_t line_len(const Text* text, size_t p)
+{
+    const char* nl = memchr(&text->data[p], '\n', text->len - p);
+    return (nl == NULL) ? text->len - p : (size_t)(nl - &text->data[p]) + 1;
+}
+
+// if the line before p is a comment
+static bool line_comment(const Text* text, size_t p)
+{
+    size_t q = p - 1;
+    while ( 0 < q && text->data[q - 1] != '\n' ) { q--; }
+    return strncmp(&text->data[q], "//", 2) == 0;
+}
+
+// x0 is declared on the first line, so "x0 = ...;" fits anywhere after it
+static void generate(Text* text, size_t lines, uint32_t* seed)
+{
+    char line[128];
+    for ( size_t i = 0; i < lines; i++ ) {
+        int n;
+        const uint32_t r = bench_rand(seed) % 10;
+        if ( i == 0 ) {
+            n = snprintf(line, sizeof(line), "x0 : int = 1;\n");
+        } else if ( r == 0 ) {
+            n = snprintf(line, sizeof(line), "// line %zu\n", i);
+        } else if ( r == 1 ) {
+            n = snprintf(line, sizeof(line), "x0 = x0 + %u; x0 = x0 ^ %zu;\n",
+                bench_rand(seed) % 100, i);
+        } else if ( r == 2 ) {
+            n = snprintf(line, sizeof(line), "x0 = (x0 *\n    %u) %% 1000;\n",
+                bench_rand(seed) % 100);
+            i++;
+        } else {
+            n = snprintf(line, sizeof(line), "x%zu : int = x0 + %u * 3;\n", i,
+                bench_rand(seed) % 1000);
+        }
+        text_edit(text, text->len, 0, line, (size_t)n);
+    }
+    text_edit(text, text->len, 0, "ret x0 % 256;\n", 14);
+}
+
+// NOTE: one random edit, mirrored to the session, returns its status.
+//       broken is the offset of the ';' a previous edit removed
+static int edit(Session* s, Text* text, uint32_t* seed, size_t* broken)
+{
+    size_t offset, deleted = 0, len = 0;
+    char str[64];
+
+    if ( *broken != SIZE_MAX ) { // fix the line that was broken
+        offset = *broken;
+        str[0] = ';';
+        len = 1;
+        *broken = SIZE_MAX;
+    } else {
+        offset = text_line(text, seed);
+        const size_t n = line_len(text, offset);
+        const char* line = &text->data[offset];
+        const uint32_t r = bench_rand(seed) % 100;
+        // NOTE: not inside "x0 = (x0 *\n 5) % 1000;", nor around the ret
+        const bool between = 1 < offset && text->data[offset - 1] == '\n'
+            && (text->data[offset - 2] == ';' || line_comment(text, offset));
+        if ( offset == 0 || offset == text->len || !between ) {
+            offset = line_len(text, 0);
+            len = (size_t)snprintf(str, sizeof(str), "x0 = %u;\n", r);
+        } else if ( r < 30 ) { // new statement
+            len = (size_t)snprintf(str, sizeof(str), "x0 = x0 - %u;\n", r);
+        } else if ( r < 50 && (strncmp(line, "x0 =", 4) == 0
+                                  || strncmp(line, "//", 2) == 0) ) {
+            if ( 1 < n && line[n - 2] == ';' ) { deleted = n; }
+        } else if ( r < 65 && memchr(line, '/', n) == NULL ) { // join lines
+            deleted = (line[n - 1] == '\n' && offset + n < text->len
+                && line[n] != '/');
+            offset += n - 1;
+            str[0] = ' ';
+            len = deleted;
+        } else if ( r < 70 ) { // drop a ';', the next edit puts it back
+            const char* semi = memchr(line, ';', n);
+            if ( semi != NULL && strncmp(line, "ret", 3) != 0 ) {
+                offset = (size_t)(semi - text->data);
+                deleted = 1;
+                *broken = offset;
+            }
+        } else { // a number in the line
+            for ( size_t i = 0; i < n; i++ ) {
+                if ( !isdigit(line[i]) || line[i - 1] != ' ' ) { continue; }
+                offset += i;
+                while ( isdigit(line[i + deleted]) ) { deleted++; }
+                len = (size_t)snprintf(str, sizeof(str), "%u", r);
+                break;
+            }
+        }
+    }
+
+    text_edit(text, offset, deleted, str, len);
+    return session_edit(s, offset, deleted, str, len);
+}
+
+// the AST dump and the assembly of a tree, as one string
+static char* render(const AST* ast)
+{
+    char* buff = NULL;
+    size_t size = 0;
+    FILE* out = open_memstream(&buff, &size);
+    ast_print_node(out, ast, ast->root, 0);
+
+    char blob[MAIN_CONTEXT_SIZE];
+    Context ctx;
+    context_init(&ctx, blob, MAIN_CONTEXT_SIZE);
+    code_gen_main(out, &ctx, ast);
+    context_free(&ctx);
+    fclose(out);
+    return buff;
+}
+// same steps as main.c
+static char* full_parse(double* ms)
+{
+    AST ast = { 0 };
+    Tokenizer0 tok = { 0 };
+    Span_Pool spool = { 0 };
+    Null_Pool npool = { 0 };
+    if ( tok_init(&tok, SRC_FILE, SCANNER_MODE_MMAP) == TOKENIZER_FAIL
+        || !spool_init(&spool, NULL) || !npool_init(&npool, NULL) ) {
+        exit(1);
+    }
+    ast_init(&ast, &tok, &npool, &spool);
+
+    const double start = now_ms();
+    if ( ast_work(&ast) ) { exit(1); }
+    *ms = now_ms() - start;
+
+    char* out = render(&ast);
+    ast_free(&ast);
+    npool_free(&npool);
+    spool_free(&spool);
+    scanner_free(&tok.scanner);
+    return out;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t lines = (1 < argc) ? strtoul(argv[1], NULL, 10) : 100000;
+    const size_t edits = (2 < argc) ? strtoul(argv[2], NULL, 10) : 10000;
+    if ( lines == 0 || edits == 0 ) {
+        fprintf(stderr, "Usage: %s [LINES] [EDITS]\n", argv[0]);
+        return 1;
+    }
+
+    uint32_t seed = 0x2545F491;
+    Text text = { 0 };
+    generate(&text, lines, &seed);
+    text_write(&text, SRC_FILE);
+
+    Session s;
+    double start = now_ms();
+    if ( session_open(&s, SRC_FILE) != SESSION_SUCCESS ) { return 1; }
+    const double open_ms = now_ms() - start;
+
+    double* times = malloc(sizeof(double) * edits);
+    if ( times == NULL ) {
+        perror("malloc");
+        return 1;
+    }
+    size_t broken = SIZE_MAX, failed = 0;
+    for ( size_t i = 0; i < edits; i++ ) {
+        start = now_ms();
+        const int status = edit(&s, &text, &seed, &broken);
+        times[i] = now_ms() - start;
+        if ( status == SESSION_FAIL ) { return 1; }
+        failed += (status == SESSION_SYNTAX);
+    }
+    if ( broken != SIZE_MAX ) { edit(&s, &text, &seed, &broken); }
+
+    double total = 0;
+    for ( size_t i = 0; i < edits; i++ ) { total += times[i]; }
+    qsort(times, edits, sizeof(double), cmp_double);
+
+    bool ok = s.tok.scanner.src_len == text.len
+        && memcmp(s.tok.scanner.src, text.data, text.len) == 0;
+    const AST* ast = session_ast(&s);
+    ok = ok && ast != NULL;
+
+    text_write(&text, SRC_FILE);
+    double full_ms;
+    char* expected = full_parse(&full_ms);
+    if ( ok ) {
+        char* got = render(ast);
+        ok = strcmp(got, expected) == 0;
+        free(got);
+    }
+
+    printf("lines: %zu, edits: %zu (%zu left a syntax error)\n", lines,
+        edits, failed);
+    printf("open:          %9.3fms\n", open_ms);
+    printf("full parse:    %9.3fms\n", full_ms);
+    printf("edit mean:     %9.3fms\n", total / (double)edits);
+    printf("edit p50:      %9.3fms\n", times[edits / 2]);
+    printf("edit p99:      %9.3fms\n", times[edits * 99 / 100]);
+    printf("edit max:      %9.3fms\n", times[edits - 1]);
+    printf("same as a full parse: %s\n", ok ? "yes" : "NO");
+
+    free(expected);
+    free(times);
+    free(text.data);
+    session_free(&s);
+    remove(SRC_FILE);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+/* Scaling benchmark for the concurrent identifier interner (Shared_Pool).
+ * Every thread interns from the same skewed identifier stream, the total work
+ * is fixed so ideal scaling halves the time when the threads double. A
+ * Null_Pool behind a single mutex is measured as the baseline.
+ *
+ *     gcc -std=c99 -D_DEFAULT_SOURCE -pthread -O2 -o ./intern_bench \
+ *         ./bench/intern.c ./src/string_pool.c ./src/utils.c
+ *     ./intern_bench [MAX_THREADS] [TOTAL_OPS]
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/string_pool.h"
+#include "../src/utils.h"
+
+#define WORDS     (1 << 15)
+#define HOT_WORDS (1 << 10)
+#define WORD_SIZE 24
+
+typedef struct Bench_s {
+    Shared_Pool* shared;
+    Null_Pool* npool;
+    pthread_mutex_t* lock;
+    const char (*words)[WORD_SIZE];
+    const size_t* lens;
+    size_t ops;
+    uint32_t seed;
+    int failed;
+} Bench;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+// xorshift32, 9 out of 10 picks come from the hot words like in real code
+static size_t bench_pick(uint32_t* seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return (x % 10 != 0) ? (x >> 8) % HOT_WORDS : (x >> 8) % WORDS;
+}
+
+static void* bench_shared(void* arg)
+{
+    Bench* b = arg;
+    Shared_Arena* arena = shpool_arena(b->shared);
+    if ( arena == NULL ) {
+        b->failed = 1;
+        return NULL;
+    }
+    for ( size_t i = 0; i < b->ops; i++ ) {
+        const size_t w = bench_pick(&b->seed);
+        if ( shpool_intern(b->shared, arena, b->words[w], b->lens[w])
+            == ATOM_NONE ) {
+            b->failed = 1;
+            return NULL;
+        }
+    }
+    return NULL;
+}
+static void* bench_locked(void* arg)
+{
+    Bench* b = arg;
+    for ( size_t i = 0; i < b->ops; i++ ) {
+        const size_t w = bench_pick(&b->seed);
+        pthread_mutex_lock(b->lock);
+        const atom_t atom = npool_intern(b->npool, b->words[w], b->lens[w]);
+        pthread_mutex_unlock(b->lock);
+        if ( atom == ATOM_NONE ) {
+            b->failed = 1;
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+// returns the wall time in ms, or a negative value on failure
+static double bench_run(
+    void* (*fn)(void*), Bench* proto, size_t threads, size_t ops)
+{
+    Bench bench[64];
+    pthread_t ids[64];
+    const double start = now_ms();
+    for ( size_t i = 0; i < threads; i++ ) {
+        bench[i] = *proto;
+        bench[i].ops = ops / threads;
+        bench[i].seed = 0x9e3779b9u * (uint32_t)(i + 1);
+        pthread_create(&ids[i], NULL, fn, &bench[i]);
+    }
+    int failed = 0;
+    for ( size_t i = 0; i < threads; i++ ) {
+        pthread_join(ids[i], NULL);
+        failed |= bench[i].failed;
+    }
+    const double ms = now_ms() - start;
+    return failed ? -1.0 : ms;
+}
+// every interned word must map back to its own text
+static int bench_check(const Shared_Pool* shared, const Bench* proto)
+{
+    for ( size_t w = 0; w < WORDS; w++ ) {
+        const char* word = proto->words[w];
+        const atom_t atom = shpool_find(shared, word, proto->lens[w]);
+        if ( atom == ATOM_NONE ) { continue; }
+        if ( strcmp(shpool_atom(shared, atom)->str, word) != 0 ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t max = (1 < argc) ? strtoul(argv[1], NULL, 10) : 64;
+    const size_t ops = (2 < argc) ? strtoul(argv[2], NULL, 10) : (1 << 22);
+    if ( max == 0 || 64 < max || ops == 0 ) {
+        fprintf(stderr, "Usage: %s [MAX_THREADS (1-64)] [TOTAL_OPS]\n",
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    static char words[WORDS][WORD_SIZE];
+    static size_t lens[WORDS];
+    for ( size_t w = 0; w < WORDS; w++ ) {
+        const int n = snprintf(words[w], WORD_SIZE, "%s_%zx",
+            (w % 3 == 0) ? "tmp" : (w % 3 == 1) ? "value" : "node_count", w);
+        lens[w] = (size_t)n;
+    }
+
+    printf("%8s %14s %14s %8s\n", "threads", "shared Mop/s", "locked Mop/s",
+        "atoms");
+    for ( size_t threads = 1; threads <= max; threads *= 2 ) {
+        Shared_Pool shared;
+        Null_Pool npool;
+        pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+        if ( !shpool_init(&shared) || !npool_init(&npool, NULL) ) {
+            LOG_ERR("failed to init the pools");
+            return EXIT_FAILURE;
+        }
+
+        Bench proto = {
+            .shared = &shared,
+            .npool = &npool,
+            .lock = &lock,
+            .words = (const char (*)[WORD_SIZE])words,
+            .lens = lens,
+        };
+        const double shared_ms = bench_run(bench_shared, &proto, threads, ops);
+        const double locked_ms = bench_run(bench_locked, &proto, threads, ops);
+        if ( shared_ms < 0 || locked_ms < 0 || !bench_check(&shared, &proto)
+            || shared.count != npool.count ) {
+            LOG_ERRF("%zu threads: interning failed", threads);
+            return EXIT_FAILURE;
+        }
+
+        printf("%8zu %14.2f %14.2f %8zu\n", threads, ops / shared_ms / 1e3,
+            ops / locked_ms / 1e3, shared.count);
+
+        shpool_free(&shared);
+        npool_free(&npool);
+        if ( threads < max && max < threads * 2 ) { threads = max / 2; }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -2,6 +2,9 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "src/ast.h"
 #include "src/codegen.h"
@@ -10,51 +13,269 @@
 #include "src/utils.h"
 
 
-int main(int argc, char* argv[])
+typedef enum {
+    OUTPUT_ASM,
+    OUTPUT_OBJ, // ELF object
+    OUTPUT_EXE, // static ELF executable
+    OUTPUT_RUN, // JIT, no OUT_FILE
+} output_t;
+
+typedef struct Options_s {
+    const char* src_file;
+    const char* out_file;
+    scanner_mode_t scanner_mode;
+    int pretokenize;
+    size_t jobs;
+    int mem_report;
+    const char* mem_json; // NULL: table only
+    const char* cache_dir; // NULL: no AST cache
+    output_t output;
+    int optimize;
+} Options;
+
+static void usage(const char* program)
+{
+    fprintf(stderr, "Usage: %s [OPTIONS] <SRC_FILE> <OUT_FILE>\n", program);
+    fprintf(stderr, "       %s [OPTIONS] --run <SRC_FILE>\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    --lines    load the source line by line (no mmap)\n");
+    fprintf(stderr, "    --stream   read the source through a fixed window\n");
+    fprintf(stderr, "    --pretok   lex the whole file before parsing\n");
+    fprintf(stderr, "    --jobs=<N> pre-tokenize on N threads (0: one per"
+                    " core)\n");
+    fprintf(stderr, "    --obj      write an ELF64 object (.o) instead of"
+                    " assembly\n");
+    fprintf(stderr, "    --exe      write a static ELF64 executable, needs no"
+                    " linker\n");
+    fprintf(stderr, "    --run      run the program in process, exit with its"
+                    " result\n");
+    fprintf(stderr, "    --no-opt   keep the tree as parsed, no constant"
+                    " folding\n");
+    fprintf(stderr, "    --cache=<DIR>\n");
+    fprintf(stderr, "               reuse the parsed tree of an unchanged"
+                    " source from DIR\n");
+    fprintf(stderr, "    --mem-report[=<FILE>]\n");
+    fprintf(stderr, "               print the memory used by each subsystem at"
+                    " exit,\n");
+    fprintf(stderr, "               and write it as JSON to FILE\n");
+    fprintf(stderr, "    -v, -vv, -vvv\n");
+    fprintf(stderr, "               log info, debug or trace messages\n");
+    fprintf(stderr, "    --log=<CAT>[,<CAT>]*\n");
+    fprintf(stderr, "               only log main, scanner, tokenizer, ast, gen"
+                    " or all\n");
+    fprintf(stderr, "SRC_FILE can be '-' to stream the source from stdin\n");
+    exit(1);
+}
+static Options parse_options(int argc, char* argv[])
+{
+    Options opts = {
+        .src_file = NULL,
+        .out_file = NULL,
+        .scanner_mode = SCANNER_MODE_MMAP,
+        .pretokenize = 0,
+        .jobs = 1,
+        .mem_report = 0,
+        .mem_json = NULL,
+        .cache_dir = NULL,
+        .output = OUTPUT_ASM,
+        .optimize = 1,
+    };
+
+    size_t positional = 0, outputs = 0; // outputs: extra ones
+    for ( int i = 1; i < argc; i++ ) {
+        const char* arg = argv[i];
+        if ( strcmp(arg, "--lines") == 0 ) {
+            opts.scanner_mode = SCANNER_MODE_LINES;
+        } else if ( strcmp(arg, "--stream") == 0 ) {
+            opts.scanner_mode = SCANNER_MODE_STREAM;
+        } else if ( strcmp(arg, "--pretok") == 0 ) {
+            opts.pretokenize = 1;
+        } else if ( strncmp(arg, "--jobs=", 7) == 0 ) {
+            char* end;
+            opts.jobs = strtoul(&arg[7], &end, 10);
+            if ( *end != '\0' || end == &arg[7] ) { usage(argv[0]); }
+            if ( opts.jobs == 0 ) { opts.jobs = sysconf(_SC_NPROCESSORS_ONLN); }
+            opts.pretokenize = 1;
+        } else if ( strcmp(arg, "--obj") == 0 ) {
+            if ( opts.output != OUTPUT_ASM ) { outputs++; }
+            opts.output = OUTPUT_OBJ;
+        } else if ( strcmp(arg, "--exe") == 0 ) {
+            if ( opts.output != OUTPUT_ASM ) { outputs++; }
+            opts.output = OUTPUT_EXE;
+        } else if ( strcmp(arg, "--run") == 0 ) {
+            if ( opts.output != OUTPUT_ASM ) { outputs++; }
+            opts.output = OUTPUT_RUN;
+        } else if ( strcmp(arg, "--no-opt") == 0 ) {
+            opts.optimize = 0;
+        } else if ( strncmp(arg, "--cache=", 8) == 0 ) {
+            if ( arg[8] == '\0' ) { usage(argv[0]); }
+            opts.cache_dir = &arg[8];
+        } else if ( strcmp(arg, "--mem-report") == 0 ) {
+            opts.mem_report = 1;
+        } else if ( strncmp(arg, "--mem-report=", 13) == 0 ) {
+            if ( arg[13] == '\0' ) { usage(argv[0]); }
+            opts.mem_report = 1;
+            opts.mem_json = &arg[13];
+        } else if ( strcmp(arg, "-v") == 0 ) {
+            log_level = LOG_LEVEL_INFO;
+        } else if ( strcmp(arg, "-vv") == 0 ) {
+            log_level = LOG_LEVEL_DEBUG;
+        } else if ( strcmp(arg, "-vvv") == 0 ) {
+            log_level = LOG_LEVEL_TRACE;
+        } else if ( strncmp(arg, "--log=", 6) == 0 ) {
+            if ( log_parse_cats(&arg[6]) != 0 ) {
+                LOG_ERRF("unknown log category in '%s'", arg);
+                usage(argv[0]);
+            }
+        } else if ( arg[0] == '-' && arg[1] == '-' ) {
+            LOG_ERRF("unknown option '%s'", arg);
+            usage(argv[0]);
+        } else if ( positional == 0 ) {
+            opts.src_file = arg;
+            positional++;
+        } else if ( positional == 1 ) {
+            opts.out_file = arg;
+            positional++;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if ( outputs != 0 ) {
+        LOG_ERR("only one of --obj, --exe and --run");
+        usage(argv[0]);
+    }
+    if ( positional != ((opts.output == OUTPUT_RUN) ? 1 : 2) ) {
+        usage(argv[0]);
+    }
+
+    // NOTE: pipes can't be mapped
+    if ( strcmp(opts.src_file, "-") == 0 ) {
+        opts.scanner_mode = SCANNER_MODE_STREAM;
+    }
+    if ( opts.pretokenize && opts.scanner_mode != SCANNER_MODE_MMAP ) {
+        LOG_ERR("--pretok needs a mapped source, not --lines/--stream/'-'");
+        usage(argv[0]);
+    }
+    if ( opts.cache_dir != NULL && opts.scanner_mode != SCANNER_MODE_MMAP ) {
+        LOG_ERR("--cache needs a mapped source, not --lines/--stream/'-'");
+        usage(argv[0]);
+    }
+
+    return opts;
+}
+
+// NOTE: from atexit, so the failed runs get their report too
+static const char* mem_json = NULL;
+static void report_memory(void)
+{
+    fprintf(stderr, "carmen: memory report\n");
+    mem_report(stderr);
+    if ( mem_json == NULL ) { return; }
+
+    FILE* out = fopen(mem_json, "w");
+    if ( out == NULL ) {
+        perror(mem_json);
+        return;
+    }
+    mem_report_json(out);
+    fclose(out);
+}
+
+static double now_ms(void)
 {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
 
-    if ( argc != 3 ) {
-        fprintf(stderr, "Usage: %s <SRC_FILE> <OUT_FILE>", argv[0]);
-        exit(1);
+int main(int argc, char* argv[])
+{
+    const Options opts = parse_options(argc, argv);
+    if ( opts.mem_report ) {
+        mem_json = opts.mem_json;
+        atexit(report_memory);
     }
 
-    printf("[CC] --> START\n");
-    // char blob[MAIN_CONTEXT_SIZE];
-    // Context main_c = context_init(blob, MAIN_CONTEXT_SIZE);
+    LOG_INFO(LOG_MAIN, "--> START");
+    int status = EXIT_SUCCESS; // NOTE: --run exits with the program's result
+    char blob[MAIN_CONTEXT_SIZE];
+    Context main_c;
+    context_init(&main_c, blob, MAIN_CONTEXT_SIZE);
 
     { // read
         AST ast = { 0 };
         Tokenizer0 tok = { 0 };
         Span_Pool spool = { 0 };
         Null_Pool npool = { 0 };
+        Token_Buffer tokens = { 0 };
+
+        // NOTE: the string pools and the codegen tables are carved from
+        //       main_c, they are all dropped with this mark at the end
+        const Context_Mark read_c = context_lock(&main_c);
 
         { // setup ast
-            if ( tok_init(&tok, argv[1]) == TOKENIZER_FAIL ) { exit(1); }
+            if ( tok_init(&tok, opts.src_file, opts.scanner_mode)
+                == TOKENIZER_FAIL ) { exit(1); }
 
-            ASSERT(spool_init(&spool));
-            ASSERT(npool_init(&npool));
+            if ( !spool_init(&spool, &main_c)
+                || !npool_init(&npool, &main_c) ) {
+                LOG_ERR("failed to init the string pools");
+                exit(EXIT_FAILURE);
+            }
 
             ast_init(&ast, &tok, &npool, &spool);
+            ast.cache_dir = opts.cache_dir;
         }
 
-        // Context loop_c = context_lock(main_c);
-        // UNUSED(loop_c);
+        // NOTE: a cached tree needs no tokens nor parsing
+        const int cached = opts.cache_dir != NULL && ast_cache_load(&ast);
+        if ( opts.pretokenize && !cached ) { // lex
+            LOG_INFO(LOG_TOKENIZER, "--> START");
+            const double start = now_ms();
+            if ( tokbuf_init(&tokens, TOKEN_BUFF_SIZE) == TOKENIZER_FAIL
+                || tokbuf_lex_parallel(&tokens, &tok, &npool, &spool, opts.jobs)
+                    == TOKENIZER_FAIL ) {
+                exit(EXIT_FAILURE);
+            }
+            LOG_INFOF(LOG_TOKENIZER, "<-- END %zu tokens in %.3fms",
+                tokens.count, now_ms() - start);
+            ast_set_tokens(&ast, &tokens);
+        }
 
         { // ast + codegen
-            printf("[AST] --> START \n");
-            if ( ast_work(&ast) ) { exit(EXIT_FAILURE); }
-            printf("[AST] <-- END \n");
+            LOG_INFO(LOG_AST, "--> START");
+            if ( !cached ) {
+                if ( ast_work(&ast) ) { exit(EXIT_FAILURE); }
+                if ( opts.cache_dir != NULL ) { ast_cache_store(&ast); }
+            }
+            if ( opts.optimize ) { ast_optimize(&ast); }
+            LOG_INFO(LOG_AST, "<-- END");
             // npool_print(ast->identifiers);
-            FILE* out = fopen(argv[2], "w");
-            ASSERT(out);
-            printf("[GEN] --> START \n");
-            code_gen_main(out, ast.root);
-            printf("[GEN] <-- END \n");
-            fclose(out);
+            LOG_INFO(LOG_GEN, "--> START");
+            if ( opts.output == OUTPUT_RUN ) {
+                status = code_gen_run(&main_c, &ast);
+            } else {
+                FILE* out = fopen(opts.out_file,
+                    (opts.output == OUTPUT_ASM) ? "w" : "wb");
+                ASSERT(out);
+                switch ( opts.output ) {
+                    case OUTPUT_OBJ: code_gen_object(out, &main_c, &ast); break;
+                    case OUTPUT_EXE: code_gen_exe(out, &main_c, &ast); break;
+                    default: code_gen_main(out, &main_c, &ast); break;
+                }
+                fclose(out);
+            }
+            LOG_INFO(LOG_GEN, "<-- END");
         }
-        // context_unlock(main_c); // free loop_c
+        ast_free(&ast);
+        tokbuf_free(&tokens);
+        npool_free(&npool);
+        spool_free(&spool);
+        scanner_free(&tok.scanner);
+        context_unlock(&main_c, read_c);
     }
-    printf("[CC] <-- END\n");
+    context_free(&main_c);
+    LOG_INFO(LOG_MAIN, "<-- END");
 
-    return EXIT_SUCCESS;
+    return status;
 }
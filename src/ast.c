@@ -3,25 +3,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "ast.h"
 #include "tokenizer.h"
 #include "utils.h"
 
-// grep -F "AST_Node* ast_" src/ast.c
-static AST_Node* ast_new(ast_node_t tag, const Token* tok, const Location* loc);
-static void* ast_add_child(AST_Node* parent, AST_Node* child);
+// grep -F "ast_ref_t ast_" src/ast.c
+static ast_ref_t ast_new(AST* ast, ast_node_t tag, const Token* tok);
+static size_t ast_open(AST* ast);
+static ast_ref_t ast_add_child(AST* ast, ast_ref_t child);
+static void ast_close(AST* ast, ast_ref_t parent, size_t base);
 
 static int ast_next_token(AST* ast);
 static Token* ast_peek_token(AST* ast);
 static int ast_accept_token(AST* ast, token_t expected_type);
-static void ast_expect_token(AST* ast, token_t expected_type);
+static int ast_expect_token(AST* ast, token_t expected_type);
 
-static AST_Node* ast_parse_primary(AST* ast);
-static AST_Node* ast_parse_return(AST* ast);
-static AST_Node* ast_parse_assing(AST* ast);
-static AST_Node* ast_parse_expr(AST* ast);
-static AST_Node* ast_parse_type(AST* ast);
+static ast_ref_t ast_parse_primary(AST* ast);
+static ast_ref_t ast_parse_return(AST* ast);
+static ast_ref_t ast_parse_expr(AST* ast);
+static ast_ref_t ast_parse_type(AST* ast);
 
 void print_error(Token* token, const char* message, const char* source_line)
 {
@@ -49,38 +51,86 @@ const char* ast_node_tag_to_str(ast_node_t tag)
         case AST_IDENT:   return "Ident";
         case AST_EXPR:    return "Expr";
         case AST_OP_ADD:  return "Op_add";
+        case AST_OP_SUB:  return "Op_sub";
         case AST_OP_MUL:  return "Op_mul";
+        case AST_OP_DIV:  return "Op_div";
+        case AST_OP_MOD:  return "Op_mod";
+        case AST_OP_SHL:  return "Op_shl";
+        case AST_OP_SHR:  return "Op_shr";
+        case AST_OP_LT:   return "Op_lt";
+        case AST_OP_GT:   return "Op_gt";
+        case AST_OP_LE:   return "Op_le";
+        case AST_OP_GE:   return "Op_ge";
+        case AST_OP_EQ:   return "Op_eq";
+        case AST_OP_NE:   return "Op_ne";
+        case AST_OP_AND:  return "Op_and";
+        case AST_OP_XOR:  return "Op_xor";
+        case AST_OP_OR:   return "Op_or";
+        case AST_OP_NEG:  return "Op_neg";
+        case AST_OP_NOT:  return "Op_not";
+        case AST_OP_BNOT: return "Op_bnot";
         case AST_ASSIGN:  return "Assign";
         case AST_DECL:    return "Decl";
         case AST_RETURN:  return "Return";
         default:          return "Unknown";
     }
 }
-void ast_print_indent(int depth)
+void ast_print_indent(FILE* out, int depth)
 {
-    for ( int i = 0; i < depth; ++i ) { printf("|   "); }
+    for ( int i = 0; i < depth; ++i ) { fprintf(out, "|   "); }
 }
-void ast_print_node(AST_Node* node, int depth)
+void ast_print_node(FILE* out, const AST* ast, ast_ref_t ref, int depth)
 {
-    if ( !node ) {
-        ast_print_indent(depth);
-        printf("(null)\n");
-        return;
+    const AST_Node* node = ast_node(ast, ref);
+    Token token;
+    ast_get_token(ast, ref, &token);
+
+    ast_print_indent(out, depth);
+    fprintf(out, "%s, ", ast_node_tag_to_str(node->tag));
+    tok_print(out, &token);
+    fprintf(out, "\n");
+
+    ast_foreach_child(ast, ref, child)
+    {
+        ast_print_node(out, ast, child, depth + 1);
     }
+}
 
-    ast_print_indent(depth);
-
-    printf("%s, ", ast_node_tag_to_str(node->tag));
-
-    tok_print(&node->tok);
-
-    printf("\n");
-
-    for ( size_t i = 0; i < node->child_count; ++i ) {
-        ast_print_node(node->children[i], depth + 1);
+// rebuilds the Token a node was made from, for diagnostics and logs
+void ast_get_token(const AST* ast, ast_ref_t ref, Token* token)
+{
+    const AST_Token* t = ast_token(ast, ref);
+    *token = (Token) {
+        .type = t->type,
+        .loc = { .row = t->row, .col = t->col },
+    };
+    switch ( t->type ) {
+        case TOK_IDENTIFIER:
+            token->atom = t->value;
+            token->rep.str = ast_ident(ast, t->value);
+            break;
+        case TOK_INTEGER: token->rep.num = t->value; break;
+        case TOK_STRING:
+            token->rep.span = (Span_String*)ast_string(ast, t->value);
+            break;
+        default: tok_fill_rep(token); break;
     }
 }
-
+size_t ast_child_count(const AST* ast, ast_ref_t ref)
+{
+    size_t count = 0;
+    ast_foreach_child(ast, ref, child) { count++; }
+    return count;
+}
+// i-th child or AST_NULL
+ast_ref_t ast_child(const AST* ast, ast_ref_t ref, size_t i)
+{
+    ast_foreach_child(ast, ref, child)
+    {
+        if ( i-- == 0 ) { return child; }
+    }
+    return AST_NULL;
+}
 
 void ast_init(AST* ast, Tokenizer0* tok, Null_Pool* ids, Span_Pool* strs)
 {
@@ -93,7 +143,7 @@ void ast_init(AST* ast, Tokenizer0* tok, Null_Pool* ids, Span_Pool* strs)
 
     { // setup buff
         *ast = (AST) {
-            .root = NULL,
+            .root = AST_NULL,
             .tok = tok,
             .identifiers = ids,
             .strings = strs,
@@ -101,44 +151,166 @@ void ast_init(AST* ast, Tokenizer0* tok, Null_Pool* ids, Span_Pool* strs)
     }
 }
 
-AST_Node* ast_new(ast_node_t tag, const Token* tok, const Location* loc)
+void ast_free(AST* ast)
 {
-    AST_Node* node = calloc(1, sizeof(AST_Node));
-    node->tag = tag;
-    node->tok = (tok != NULL) ? *tok : (Token) { 0 };
-    node->loc = (loc) ? *loc : (tok != NULL) ? tok->loc : (Location) { 0 };
-    node->children = NULL;
-    node->child_count = 0;
-    return node;
+    if ( ast->cache != NULL ) {
+        munmap((void*)ast->cache, ast->cache->size);
+        ast->cache = NULL;
+    }
+    // NOTE: no cap, the tables are (were) in the mapping
+    if ( ast->node_cap != 0 ) { mem_free(ast->nodes); }
+    if ( ast->tok_cap != 0 ) { mem_free(ast->tok_table); }
+    mem_free(ast->stack);
+    mem_free(ast->ops);
+    ast->nodes = NULL;
+    ast->tok_table = NULL;
+    ast->stack = NULL;
+    ast->ops = NULL;
+    ast->node_count = ast->node_cap = 0;
+    ast->tok_count = ast->tok_cap = 0;
+    ast->stack_len = ast->stack_cap = 0;
+    ast->ops_len = ast->ops_cap = 0;
 }
-void* ast_add_child(AST_Node* parent, AST_Node* child)
+
+void ast_set_tokens(AST* ast, const Token_Buffer* tokens)
 {
-    if ( child == NULL ) { return NULL; }
-    void* children = realloc(
-        parent->children, sizeof(AST_Node*) * (parent->child_count + 1));
-    // TODO die() if fails
-    if ( children == NULL ) { return NULL; }
-    parent->children = children;
-    parent->children[parent->child_count++] = child;
-    return children;
+    { // sanity check
+        ASSERT(ast != NULL);
+        ASSERT(tokens != NULL);
+        ASSERT(tokens->count != 0);
+    }
+
+    ast->tokens = tokens;
+    ast->cursor = 0;
+    ast->has_peeked = 0;
+}
+// NOTE: parse from another tokenizer, a view over a few lines (session.c)
+void ast_set_tokenizer(AST* ast, Tokenizer0* tok)
+{
+    { // sanity check
+        ASSERT(ast != NULL);
+        ASSERT(tok != NULL);
+    }
+
+    ast->tok = tok;
+    ast->tokens = NULL;
+    ast->has_peeked = 0;
+}
+
+// NOTE: the node and token tables are two big arrays, realloc can usually
+//       grow them in place (mremap), so they live outside of the context.
+static void* ast_grow(void* data, size_t* cap, size_t size)
+{
+    const size_t new_cap = (*cap == 0) ? AST_BUFF_SIZE : *cap * 2;
+    void* new_data = mem_realloc(MEM_AST, data, size * new_cap);
+    if ( new_data == NULL || UINT32_MAX < new_cap ) {
+        LOG_ERR("out of memory");
+        exit(EXIT_FAILURE);
+    }
+    *cap = new_cap;
+    return new_data;
+}
+static uint32_t ast_add_token(AST* ast, const Token* tok)
+{
+    if ( ast->tok_count == ast->tok_cap ) {
+        ast->tok_table
+            = ast_grow(ast->tok_table, &ast->tok_cap, sizeof(AST_Token));
+    }
+    if ( ast->tok_count == 0 ) { // dummy
+        ast->tok_table[ast->tok_count++] = (AST_Token) { .type = TOK_ILLEGAL };
+    }
+    if ( tok == NULL ) { return 0; }
+
+    uint32_t value = 0;
+    switch ( tok->type ) {
+        case TOK_IDENTIFIER: value = tok->atom; break;
+        case TOK_INTEGER:    value = (uint32_t)tok->rep.num; break;
+        case TOK_STRING:     value = (uint32_t)tok->rep.span->id; break;
+        default:             break;
+    }
+    ast->tok_table[ast->tok_count] = (AST_Token) {
+        .type = tok->type,
+        .row = (uint32_t)tok->loc.row,
+        .col = (uint32_t)tok->loc.col,
+        .value = value,
+    };
+    return (uint32_t)ast->tok_count++;
+}
+ast_ref_t ast_new(AST* ast, ast_node_t tag, const Token* tok)
+{
+    if ( ast->node_count == ast->node_cap ) {
+        ast->nodes = ast_grow(ast->nodes, &ast->node_cap, sizeof(AST_Node));
+    }
+    const ast_ref_t ref = (ast_ref_t)ast->node_count++;
+    ast->nodes[ref] = (AST_Node) {
+        .tag = tag,
+        .token = ast_add_token(ast, tok),
+        .first_child = AST_NULL,
+        .next_sibling = AST_NULL,
+    };
+    return ref;
+}
+// NOTE: children are pushed on a scratch stack while their parent is being
+//       parsed and linked as siblings when it is closed. nested parents
+//       always close before the outer one goes on, so every open parent owns
+//       the top of the stack:
+//           size_t base = ast_open(ast);
+//           ast_add_child(ast, child); ...
+//           ast_close(ast, parent, base);
+size_t ast_open(AST* ast) { return ast->stack_len; }
+ast_ref_t ast_add_child(AST* ast, ast_ref_t child)
+{
+    if ( child == AST_NULL ) { return AST_NULL; }
+    if ( ast->stack_len == ast->stack_cap ) {
+        const size_t cap = (ast->stack_cap == 0) ? 64 : ast->stack_cap * 2;
+        ast_ref_t* stack
+            = mem_realloc(MEM_AST, ast->stack, sizeof(ast_ref_t) * cap);
+        if ( stack == NULL ) { return AST_NULL; }
+        ast->stack = stack;
+        ast->stack_cap = cap;
+    }
+    ast->stack[ast->stack_len++] = child;
+    return child;
+}
+void ast_close(AST* ast, ast_ref_t parent, size_t base)
+{
+    { // sanity check
+        ASSERT(base <= ast->stack_len);
+    }
+
+    ast_ref_t next = AST_NULL;
+    for ( size_t i = ast->stack_len; base < i; i-- ) {
+        ast->nodes[ast->stack[i - 1]].next_sibling = next;
+        next = ast->stack[i - 1];
+    }
+    ast->nodes[parent].first_child = next;
+    ast->stack_len = base;
 }
 
 // next
 int ast_next_token(AST* ast)
 {
-    switch ( tok_next(ast->tok, &ast->peek, ast->identifiers, ast->strings) ) {
-        case TOKENIZER_FAIL: return false;
-        case TOKENIZER_EOF:
-        case TOKENIZER_SUCCESS:
-            ast->has_peeked = 1;
-            // debug
-            printf("---> ");
-            tok_print(&ast->peek);
-            printf("\n");
-            // getchar();
-            return true;
-        default: UNREACHABLE("???");
+    if ( ast->has_peeked ) { ast->last_row = ast->peek.loc.row; }
+    if ( ast->tokens != NULL ) { // pre-tokenized, the last one is TOK_EOF
+        tokbuf_get(ast->tokens, ast->cursor, &ast->peek);
+        if ( ast->cursor + 1 < ast->tokens->count ) { ast->cursor++; }
+    } else {
+        switch (
+            tok_next(ast->tok, &ast->peek, ast->identifiers, ast->strings) ) {
+            case TOKENIZER_FAIL: return false;
+            case TOKENIZER_EOF:
+            case TOKENIZER_SUCCESS: break;
+            default:                UNREACHABLE("???");
+        }
     }
+
+    ast->has_peeked = 1;
+    if ( LOG_ENABLED(TRACE, LOG_AST) ) {
+        log_prefix(LOG_LEVEL_TRACE, LOG_AST);
+        tok_print(LOG_STREAM, &ast->peek);
+        fprintf(LOG_STREAM, "\n");
+    }
+    return true;
 }
 // get current
 Token* ast_peek_token(AST* ast)
@@ -159,8 +331,8 @@ int ast_accept_token(AST* ast, token_t expected_type)
 {
     return ast_check_token(ast, expected_type) && ast_next_token(ast);
 }
-// if current token matches next or and throw error
-void ast_expect_token(AST* ast, token_t expected_type)
+// if current token matches read next, if not print an error
+int ast_expect_token(AST* ast, token_t expected_type)
 {
     Token* token = ast_peek_token(ast);
     if ( !ast_check_token(ast, expected_type) ) {
@@ -170,10 +342,10 @@ void ast_expect_token(AST* ast, token_t expected_type)
             "\n",
             token->loc.row, token->loc.col, tok_get_type_rep(expected_type),
             tok_get_type_rep(token->type));
-        tok_print_rep(token);
-        exit(1);
+        tok_print_rep(stderr, token);
+        return false;
     }
-    ast_next_token(ast);
+    return ast_next_token(ast);
 }
 
 // TODO: ast_expect_node()...
@@ -185,112 +357,225 @@ void ast_expect_token(AST* ast, token_t expected_type)
 //       error and die();
 
 // primary = INT | IDENT
-AST_Node* ast_parse_primary(AST* ast)
+ast_ref_t ast_parse_primary(AST* ast)
 {
     Token token = *ast_peek_token(ast);
     if ( ast_accept_token(ast, TOK_INTEGER) ) {
-        return ast_new(AST_LIT_INT, &token, NULL);
+        if ( UINT32_MAX < token.rep.num ) {
+            LOG_ERRF("%zu:%zu: integer literal too big", token.loc.row,
+                token.loc.col);
+            return AST_NULL;
+        }
+        return ast_new(ast, AST_LIT_INT, &token);
     } else if ( ast_accept_token(ast, TOK_IDENTIFIER) ) {
-        return ast_new(AST_IDENT, &token, NULL);
+        return ast_new(ast, AST_IDENT, &token);
     }
     fprintf(stderr,
         "carmen:error:%zu:%zu: expected primary expr tok, but got '%s'\n",
         token.loc.row, token.loc.col, tok_get_type_rep(token.type));
-    tok_print_rep(&token);
-    return NULL;
+    tok_print_rep(stderr, &token);
+    return AST_NULL;
 }
 
 
 // (1) "ret" EXPR ";"
-AST_Node* ast_parse_return(AST* ast)
+ast_ref_t ast_parse_return(AST* ast)
 {
     Token base = *ast_peek_token(ast);
-    AST_Node* expr = ast_parse_expr(ast);
-    ASSERT(expr != NULL);
+    const size_t children = ast_open(ast);
+    ast_ref_t expr = ast_parse_expr(ast);
+    if ( expr == AST_NULL ) { return AST_NULL; }
 
-    AST_Node* node = ast_new(AST_RETURN, &base, NULL);
-    ast_add_child(node, expr);
+    ast_ref_t node = ast_new(ast, AST_RETURN, &base);
+    ast_add_child(ast, expr);
+    ast_close(ast, node, children);
     return node;
 }
-AST_Node* ast_parse_assing(AST* ast)
-{
-    Token base = *ast_peek_token(ast);
-    AST_Node* expr = ast_parse_expr(ast);
-    if ( !expr ) { return NULL; }
 
-    ast_expect_token(ast, TOK_SEMICOLON);
+// NOTE: binary operators bind by prec (higher first, all of them left
+//       associative, same levels as C), unary ones bind tighter than any
+//       binary one. AST_ROOT means the token is not that kind of operator.
+#define AST_PREC_UNARY 11
+static const struct {
+    uint8_t binary; // ast_node_t
+    uint8_t prec;
+    uint8_t unary; // ast_node_t
+} ast_ops[TOK__COMPOUND_END] = {
+    [TOK_STAR] = { AST_OP_MUL, 10, AST_ROOT },
+    [TOK_SLASH] = { AST_OP_DIV, 10, AST_ROOT },
+    [TOK_PERCENT] = { AST_OP_MOD, 10, AST_ROOT },
+    [TOK_PLUS] = { AST_OP_ADD, 9, AST_ROOT },
+    [TOK_MINUS] = { AST_OP_SUB, 9, AST_OP_NEG },
+    [TOK_COMPOUND_LSHIFT] = { AST_OP_SHL, 8, AST_ROOT },
+    [TOK_COMPOUND_RSHIFT] = { AST_OP_SHR, 8, AST_ROOT },
+    [TOK_LESS] = { AST_OP_LT, 7, AST_ROOT },
+    [TOK_GREATER] = { AST_OP_GT, 7, AST_ROOT },
+    [TOK_COMPOUND_LE] = { AST_OP_LE, 7, AST_ROOT },
+    [TOK_COMPOUND_GE] = { AST_OP_GE, 7, AST_ROOT },
+    [TOK_COMPOUND_EQ] = { AST_OP_EQ, 6, AST_ROOT },
+    [TOK_COMPOUND_NE] = { AST_OP_NE, 6, AST_ROOT },
+    [TOK_AMPERSAND] = { AST_OP_AND, 5, AST_ROOT },
+    [TOK_CARET] = { AST_OP_XOR, 4, AST_ROOT },
+    [TOK_PIPE] = { AST_OP_OR, 3, AST_ROOT },
+    [TOK_EXCLAMATION] = { AST_ROOT, 0, AST_OP_NOT },
+    [TOK_TILDE] = { AST_ROOT, 0, AST_OP_BNOT },
+};
+STATIC_ASSERT(AST_OP_BNOT <= UINT8_MAX, "ast_node_t must fit in ast_ops[]");
+
+static int ast_push_op(AST* ast, ast_ref_t node, uint32_t prec)
+{
+    if ( ast->ops_len == ast->ops_cap ) {
+        const size_t cap = (ast->ops_cap == 0) ? 64 : ast->ops_cap * 2;
+        AST_Op* ops = mem_realloc(MEM_AST, ast->ops, sizeof(AST_Op) * cap);
+        if ( ops == NULL ) { return false; }
+        ast->ops = ops;
+        ast->ops_cap = cap;
+    }
+    ast->ops[ast->ops_len++] = (AST_Op) { .node = node, .prec = prec };
+    return true;
+}
+// pops the top operator, its operands are the top of the scratch stack
+static void ast_reduce(AST* ast)
+{
+    const AST_Op op = ast->ops[--ast->ops_len];
+    const size_t arity = (op.prec == AST_PREC_UNARY) ? 1 : 2;
+    { // sanity check
+        ASSERT(op.node != AST_NULL);
+        ASSERT(arity <= ast->stack_len);
+    }
 
-    AST_Node* node = ast_new(AST_RETURN, &base, NULL);
-    ast_add_child(node, expr);
-    return node;
+    ast_close(ast, op.node, ast->stack_len - arity);
+    ast_add_child(ast, op.node); // NOTE: can't fail, the operands made room
+}
+static ast_ref_t ast_expr_fail(AST* ast, size_t children, size_t ops)
+{
+    ast->stack_len = children;
+    ast->ops_len = ops;
+    return AST_NULL;
 }
 
-// (1) PRIMARY [OP PRIMARY]*
-AST_Node* ast_parse_expr(AST* ast)
+// (1) OPERAND [BINOP OPERAND]* ";"
+//     OPERAND := [UNOP]* PRIMARY | [UNOP]* "(" OPERAND [BINOP OPERAND]* ")"
+// NOTE: operator precedence with two explicit stacks instead of recursion, so
+//       deep machine generated expressions can't blow the C stack. operands
+//       go on the scratch stack and operators on ast->ops, an operator is
+//       reduced (gets its operands as children) once one that binds less
+//       shows up. an open paren is an operator with prec 0, nothing reduces
+//       past it until its ")".
+ast_ref_t ast_parse_expr(AST* ast)
 {
     Token base = *ast_peek_token(ast);
-    AST_Node* v = ast_parse_primary(ast);
-    ASSERT(v != NULL);
-
-    // TODO: base.loc is not saving when printing the tree...
-    // printf("[%zu:%zu]\n", base.loc.row, base.loc.col);
-    AST_Node* node = ast_new(AST_EXPR, NULL, &base.loc);
-    // printf("[%zu:%zu]\n", node->loc.row, node->loc.col);
-    ast_add_child(node, v);
+    const size_t children = ast_open(ast);
+    const size_t ops = ast->ops_len;
+    ast_ref_t node = ast_new(ast, AST_EXPR, &base);
 
-    // TODO: priority stuff later...
-    // TODO: parens...
+    size_t parens = 0;
+    int operand = 1; // expecting an operand, not an operator
     while ( 1 ) {
-        Token op_tok = *ast_peek_token(ast);
-
-        // for now just '*' and '+' bin ops
-        if ( ast_accept_token(ast, TOK_PLUS)
-            || ast_accept_token(ast, TOK_STAR) ) {
-            int t = op_tok.rep.c == '+' ? AST_OP_ADD : AST_OP_MUL;
-            AST_Node* op = ast_new(t, &op_tok, NULL);
-            ASSERT(ast_add_child(node, op));
-            AST_Node* prim = ast_parse_primary(ast);
-            ASSERT(ast_add_child(node, prim));
+        const Token token = *ast_peek_token(ast);
+        const size_t type = (token.type < TOK__COMPOUND_END) ? token.type : 0;
+
+        if ( operand ) {
+            if ( ast_accept_token(ast, TOK_LPAREN) ) {
+                if ( !ast_push_op(ast, AST_NULL, 0) ) { break; }
+                parens++;
+                continue;
+            }
+            if ( ast_accept_token(ast, TOK_PLUS) ) { continue; } // noop
+            if ( ast_ops[type].unary != AST_ROOT ) {
+                if ( !ast_next_token(ast) ) {
+                    return ast_expr_fail(ast, children, ops);
+                }
+                ast_ref_t op = ast_new(ast, ast_ops[type].unary, &token);
+                if ( !ast_push_op(ast, op, AST_PREC_UNARY) ) { break; }
+                continue;
+            }
+            ast_ref_t prim = ast_parse_primary(ast);
+            if ( prim == AST_NULL ) {
+                return ast_expr_fail(ast, children, ops);
+            }
+            if ( ast_add_child(ast, prim) == AST_NULL ) { break; }
+            operand = 0;
             continue;
         }
-        ast_expect_token(ast, TOK_SEMICOLON);
-        break;
+
+        if ( ast_ops[type].binary != AST_ROOT ) {
+            const uint32_t prec = ast_ops[type].prec;
+            while ( ops < ast->ops_len
+                && prec <= ast->ops[ast->ops_len - 1].prec ) {
+                ast_reduce(ast);
+            }
+            if ( !ast_next_token(ast) ) {
+                return ast_expr_fail(ast, children, ops);
+            }
+            ast_ref_t op = ast_new(ast, ast_ops[type].binary, &token);
+            if ( !ast_push_op(ast, op, prec) ) { break; }
+            operand = 1;
+            continue;
+        }
+        if ( 0 < parens && ast_accept_token(ast, TOK_RPAREN) ) {
+            while ( ast->ops[ast->ops_len - 1].node != AST_NULL ) {
+                ast_reduce(ast);
+            }
+            ast->ops_len--;
+            parens--;
+            continue;
+        }
+
+        if ( 0 < parens ) {
+            LOG_ERRF("%zu:%zu: expected ')' to close the expression",
+                token.loc.row, token.loc.col);
+            tok_print_rep(stderr, &token);
+            return ast_expr_fail(ast, children, ops);
+        }
+        while ( ops < ast->ops_len ) { ast_reduce(ast); }
+        if ( !ast_expect_token(ast, TOK_SEMICOLON) ) {
+            return ast_expr_fail(ast, children, ops);
+        }
+
+        ast_close(ast, node, children);
+        return node;
     }
 
-    return node;
+    LOG_ERR("out of memory");
+    return ast_expr_fail(ast, children, ops);
 }
 
 // (1) TYPE ";"
 // (2) TYPE = EXPR
-AST_Node* ast_parse_type(AST* ast)
+ast_ref_t ast_parse_type(AST* ast)
 {
     Token base = *ast_peek_token(ast);
     if ( !ast_accept_token(ast, TOK_KEYWORD_INT) ) { // INTEGER JUST FOR NOW
-        TODO("UNIMPLEMENTED TYPES");
-        return NULL;
+        // TODO: UNIMPLEMENTED TYPES
+        LOG_ERRF("%zu:%zu: only 'int' is supported as a type",
+            base.loc.row, base.loc.col);
+        tok_print_rep(stderr, &base);
+        return AST_NULL;
     }
 
-    AST_Node* node = ast_new(AST_TYPE, &base, NULL);
+    ast_ref_t node = ast_new(ast, AST_TYPE, &base);
 
     if ( ast_check_token(ast, TOK_EQUAL) ) { return node; }
 
-    ast_expect_token(ast, TOK_SEMICOLON);
+    if ( !ast_expect_token(ast, TOK_SEMICOLON) ) { return AST_NULL; }
     return node;
 }
-AST_Node* parse_assign(AST* ast)
+ast_ref_t parse_assign(AST* ast)
 {
     Token base = *ast_peek_token(ast);
-    AST_Node* node = ast_new(AST_ASSIGN, &base, NULL);
-    ASSERT(node);
+    ast_ref_t node = ast_new(ast, AST_ASSIGN, &base);
 
-    AST_Node* expr = ast_parse_expr(ast);
-    ASSERT(expr);
-    ast_add_child(node, expr);
+    const size_t children = ast_open(ast);
+    ast_ref_t expr = ast_parse_expr(ast);
+    if ( expr == AST_NULL ) { return AST_NULL; }
+    ast_add_child(ast, expr);
+    ast_close(ast, node, children);
 
     return node;
 }
 
-AST_Node* parse_stmt(AST* ast)
+ast_ref_t parse_stmt(AST* ast)
 {
     Token token = *ast_peek_token(ast);
 
@@ -300,40 +585,91 @@ AST_Node* parse_stmt(AST* ast)
 
     if ( ast_accept_token(ast, TOK_IDENTIFIER) ) {
         if ( ast_accept_token(ast, TOK_COLON) ) {
-            AST_Node* node = ast_new(AST_DECL, &token, NULL);
-            ast_add_child(node, ast_parse_type(ast));
+            ast_ref_t node = ast_new(ast, AST_DECL, &token);
+            const size_t children = ast_open(ast);
+            ast_ref_t type = ast_parse_type(ast);
+            if ( type == AST_NULL ) { return AST_NULL; }
+            ast_add_child(ast, type);
             if ( ast_accept_token(ast, TOK_EQUAL) ) {
-                ast_add_child(node, ast_parse_expr(ast));
+                ast_ref_t expr = ast_parse_expr(ast);
+                if ( expr == AST_NULL ) { return AST_NULL; }
+                ast_add_child(ast, expr);
             }
+            ast_close(ast, node, children);
             return node;
         }
         if ( ast_accept_token(ast, TOK_EQUAL) ) {
-            AST_Node* node = ast_new(AST_ASSIGN, &token, NULL);
-            ast_add_child(node, ast_parse_expr(ast));
+            ast_ref_t node = ast_new(ast, AST_ASSIGN, &token);
+            const size_t children = ast_open(ast);
+            ast_ref_t expr = ast_parse_expr(ast);
+            if ( expr == AST_NULL ) { return AST_NULL; }
+            ast_add_child(ast, expr);
+            ast_close(ast, node, children);
             return node;
         }
     }
 
     LOG_ERRF(
         "%zu:%zu: unexpected start of statement", token.loc.row, token.loc.col);
-    tok_print_rep(&token);
-    return NULL;
+    tok_print_rep(stderr, &token);
+    return AST_NULL;
+}
+
+// creates the dummy root, node 0
+void ast_begin(AST* ast)
+{
+    ast_ref_t root = ast_new(ast, AST_ROOT, NULL);
+    ASSERT(root == AST_NULL); // NOTE: the root is node 0
+    ast->root = root;
+}
+int ast_at_eof(AST* ast) { return ast_peek_token(ast)->type == TOK_EOF; }
+// NOTE: a single top-level statement, not linked to the root, for callers
+//       that keep their own list of them (session.c). its nodes and tokens
+//       are the ones added by the call. on an error the scratch stacks are
+//       left as they were. rows are the lines of its first and last token.
+ast_ref_t ast_parse_stmt(AST* ast, size_t* first_row, size_t* last_row)
+{
+    const size_t children = ast->stack_len;
+    const size_t ops = ast->ops_len;
+
+    *first_row = ast_peek_token(ast)->loc.row;
+    ast_ref_t node = parse_stmt(ast);
+    if ( node == AST_NULL ) {
+        ast->stack_len = children;
+        ast->ops_len = ops;
+    }
+    *last_row = ast->last_row;
+    return node;
 }
 
 int ast_work(AST* ast)
 {
-    AST_Node* root = ast_new(AST_ROOT, NULL, NULL); // dummy root
+    ast_begin(ast);
+    const ast_ref_t root = ast->root;
+    const size_t children = ast_open(ast);
 
     while ( 1 ) {
-        printf("\n{NEW NODE} ================================\n");
+        LOG_TRACE(LOG_AST, "{NEW NODE} ================================");
         if ( ast_peek_token(ast)->type == TOK_EOF ) { break; }
 
-        AST_Node* node = parse_stmt(ast);
-        if ( !node ) { return 1; }
+        ast_ref_t node = parse_stmt(ast);
+        if ( node == AST_NULL ) { return 1; }
 
-        ast_add_child(root, node);
+        if ( ast_add_child(ast, node) == AST_NULL ) {
+            LOG_ERR("out of memory");
+            return 1;
+        }
+    }
+    ast_close(ast, root, children);
+
+    mem_free(ast->stack);
+    mem_free(ast->ops);
+    ast->stack = NULL;
+    ast->ops = NULL;
+    ast->stack_cap = 0;
+    ast->ops_cap = 0;
+    if ( LOG_ENABLED(TRACE, LOG_AST) ) {
+        ast_print_node(LOG_STREAM, ast, root, 0);
     }
-    // ast_print_node(root, 0);
-    ast->root = root;
     return 0;
 }
@@ -2,6 +2,8 @@
 #define _AST_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #include "string_pool.h"
 #include "tokenizer.h"
@@ -34,8 +36,27 @@ typedef enum {
     AST_RETURN,
     AST_IDENT,
     AST_LIT_INT,
+    // binary, children are the lhs and the rhs
     AST_OP_ADD,
+    AST_OP_SUB,
     AST_OP_MUL,
+    AST_OP_DIV,
+    AST_OP_MOD,
+    AST_OP_SHL,
+    AST_OP_SHR,
+    AST_OP_LT,
+    AST_OP_GT,
+    AST_OP_LE,
+    AST_OP_GE,
+    AST_OP_EQ,
+    AST_OP_NE,
+    AST_OP_AND,
+    AST_OP_XOR,
+    AST_OP_OR,
+    // unary, one child
+    AST_OP_NEG,
+    AST_OP_NOT,
+    AST_OP_BNOT,
 } ast_node_t;
 
 // // NOTE: this is not definitive nor the full/correct syntax :)
@@ -98,27 +119,149 @@ typedef enum {
 //     AST__COUNT
 // } ast_node_t;
 
-typedef struct AST_Node_s AST_Node;
-struct AST_Node_s {
-    ast_node_t tag;
-    Token tok;
-    Location loc;
-    size_t child_count;
-    AST_Node** children;
-};
+// NOTE: flat tree, every node lives in AST.nodes and refers to the others by
+//       index. children are a singly linked list (first_child, then
+//       next_sibling), AST_NULL ends it. node 0 is the root, it is never a
+//       child so 0 doubles as the null ref. the token of a node is resolved
+//       through the AST.tokens side table.
+typedef uint32_t ast_ref_t;
+#define AST_NULL ((ast_ref_t)0)
+
+typedef struct AST_Node_s {
+    uint8_t tag; // ast_node_t
+    uint8_t _pad[3];
+    uint32_t token;
+    ast_ref_t first_child;
+    ast_ref_t next_sibling;
+} AST_Node;
+STATIC_ASSERT(sizeof(AST_Node) == 16, "AST_Node must stay 16 bytes");
+
+// NOTE: value is the atom of an identifier, the id of a string literal
+//       (Span_String.id) or the value of an integer. token 0 is a dummy for
+//       the nodes without one.
+typedef struct AST_Token_s {
+    uint8_t type; // token_t
+    uint8_t _pad[3];
+    uint32_t row;
+    uint32_t col;
+    uint32_t value;
+} AST_Token;
+STATIC_ASSERT(sizeof(AST_Token) == 16, "AST_Token must stay 16 bytes");
+
+// NOTE: the on-disk form of a tree (ast_cache.c), every section is an offset
+//       from the start of the file so a read-only mapping of it is used as
+//       is. idents[atom] is the offset of its '\0' terminated text,
+//       strings[id] the one of a Span_String (8 byte aligned).
+typedef struct AST_Cache_s {
+    char magic[8];
+    uint64_t key; // hash of the source and the compiler version
+    uint64_t src_len;
+    uint32_t size; // of the whole file
+    uint32_t node_count;
+    uint32_t tok_count;
+    uint32_t ident_count;
+    uint32_t string_count;
+    uint32_t nodes;   // AST_Node[node_count]
+    uint32_t tokens;  // AST_Token[tok_count]
+    uint32_t idents;  // uint32_t[ident_count]
+    uint32_t strings; // uint32_t[string_count]
+    uint32_t _pad;
+} AST_Cache;
+STATIC_ASSERT(sizeof(AST_Cache) == 64, "AST_Cache must stay 64 bytes");
+
+// NOTE: operator waiting for its operands, see ast_parse_expr
+typedef struct AST_Op_s {
+    ast_ref_t node; // AST_NULL for an open paren
+    uint32_t prec;
+} AST_Op;
 
 typedef struct {
     Tokenizer0* tok;
     Null_Pool* identifiers;
     Span_Pool* strings;
-    AST_Node* root;
+    ast_ref_t root;
+
+    size_t node_count;
+    size_t node_cap;
+    AST_Node* nodes;
+    size_t tok_count;
+    size_t tok_cap;
+    AST_Token* tok_table;
 
     Token peek;
     int has_peeked;
+    size_t last_row; // of the last token read past peek
+
+    // NOTE: when set tokens are read from the pre-tokenized buffer instead of
+    //       the tokenizer, cursor is the index of the next one.
+    const Token_Buffer* tokens;
+    size_t cursor;
+
+    // NOTE: children of the nodes still being parsed, see ast_open
+    ast_ref_t* stack;
+    size_t stack_len;
+    size_t stack_cap;
+    AST_Op* ops;
+    size_t ops_len;
+    size_t ops_cap;
+
+    // NOTE: with a cache_dir ast_cache_load maps the tree from there when
+    //       the source didn't change. on a hit cache is the mapping, the
+    //       tables point into it and identifiers/strings are not used.
+    const char* cache_dir;
+    const AST_Cache* cache;
+    uint64_t cache_key;
+    int has_cache_key;
 } AST;
 
+static inline const AST_Node* ast_node(const AST* ast, ast_ref_t ref)
+{
+    return &ast->nodes[ref];
+}
+static inline const AST_Token* ast_token(const AST* ast, ast_ref_t ref)
+{
+    return &ast->tok_table[ast->nodes[ref].token];
+}
+// text of an identifier
+static inline const char* ast_ident(const AST* ast, atom_t atom)
+{
+    if ( ast->cache == NULL ) { return npool_str(ast->identifiers, atom); }
+    const char* base = (const char*)ast->cache;
+    return &base[((const uint32_t*)&base[ast->cache->idents])[atom]];
+}
+// string literals by id, in order of first appearance
+static inline size_t ast_string_count(const AST* ast)
+{
+    if ( ast->cache == NULL ) { return ast->strings->count; }
+    return ast->cache->string_count;
+}
+static inline const Span_String* ast_string(const AST* ast, size_t id)
+{
+    if ( ast->cache == NULL ) { return ast->strings->strings[id]; }
+    const char* base = (const char*)ast->cache;
+    const uint32_t* strings = (const uint32_t*)&base[ast->cache->strings];
+    return (const Span_String*)&base[strings[id]];
+}
+#define ast_foreach_child(ast, parent, child)                                 \
+    for ( ast_ref_t child = (ast)->nodes[parent].first_child;                 \
+          child != AST_NULL; child = (ast)->nodes[child].next_sibling )
+
 extern int ast_work(AST* const ast);
 extern void ast_init(AST* ast, Tokenizer0* tok, Null_Pool* ids, Span_Pool* strs);
-extern void ast_print_node(AST_Node* node, int depth);
+extern void ast_free(AST* ast);
+extern void ast_set_tokens(AST* ast, const Token_Buffer* tokens);
+extern void ast_set_tokenizer(AST* ast, Tokenizer0* tok);
+extern void ast_begin(AST* ast);
+extern int ast_at_eof(AST* ast);
+extern ast_ref_t ast_parse_stmt(AST* ast, size_t* first_row, size_t* last_row);
+extern int ast_cache_load(AST* ast);
+extern int ast_cache_store(AST* ast);
+// folds constants and drops the locals never read, see ast_opt.c
+extern void ast_optimize(AST* ast);
+extern void ast_get_token(const AST* ast, ast_ref_t ref, Token* token);
+extern size_t ast_child_count(const AST* ast, ast_ref_t ref);
+extern ast_ref_t ast_child(const AST* ast, ast_ref_t ref, size_t i);
+extern const char* ast_node_tag_to_str(ast_node_t tag);
+extern void ast_print_node(FILE* out, const AST* ast, ast_ref_t ref, int depth);
 
 #endif // !_AST_H
@@ -0,0 +1,260 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ast.h"
+#include "config.h"
+#include "utils.h"
+
+#define AST_CACHE_MAGIC "CARMAST" // with its '\0', 8 bytes
+
+// NOTE: not a cryptographic hash, just a fast one (8 bytes a step with a
+//       final mix) good enough to tell two versions of a file apart.
+static uint64_t cache_hash(const char* data, size_t len, uint64_t seed)
+{
+    const uint64_t k = 0x9E3779B97F4A7C15ull;
+    uint64_t h = seed ^ (len * k);
+    size_t i = 0;
+    for ( ; i + 8 <= len; i += 8 ) {
+        uint64_t w;
+        memcpy(&w, &data[i], 8);
+        h = (h ^ w) * k;
+        h ^= h >> 29;
+    }
+    uint64_t w = 0;
+    memcpy(&w, &data[i], len - i);
+    h = (h ^ w) * k;
+    h ^= h >> 32;
+    h *= k;
+    h ^= h >> 29;
+    return h;
+}
+
+// source hash mixed with the compiler version, only for mapped sources
+static int cache_key(AST* ast)
+{
+    if ( ast->has_cache_key ) { return true; }
+
+    const Scanner* scanner = &ast->tok->scanner;
+    if ( scanner->mode != SCANNER_MODE_MMAP ) {
+        LOG_INFO(LOG_AST, "cache: only for mapped sources, skipped");
+        return false;
+    }
+    const uint64_t version = cache_hash(
+        CARMEN_VERSION, sizeof(CARMEN_VERSION) - 1, AST_CACHE_FORMAT);
+    ast->cache_key = cache_hash(scanner->src, scanner->src_len, version);
+    ast->has_cache_key = true;
+    return true;
+}
+static void cache_path(const AST* ast, char* path, size_t size)
+{
+    snprintf(path, size, "%s/%016" PRIx64 ".ast", ast->cache_dir,
+        ast->cache_key);
+}
+
+// count elements of size at off, inside the file and aligned
+static int cache_section(
+    const AST_Cache* cache, uint32_t off, size_t count, size_t size)
+{
+    return off % 4 == 0 && off <= cache->size
+        && count <= (cache->size - off) / size;
+}
+// NOTE: guards against foreign, truncated or stale files, not against
+//       crafted ones (the node refs are trusted)
+static int cache_valid(const AST_Cache* cache, const AST* ast, size_t len)
+{
+    if ( len < sizeof(AST_Cache) || cache->size != len
+        || memcmp(cache->magic, AST_CACHE_MAGIC, 8) != 0
+        || cache->key != ast->cache_key
+        || cache->src_len != ast->tok->scanner.src_len
+        || cache->node_count == 0
+        || !cache_section(cache, cache->nodes, cache->node_count,
+            sizeof(AST_Node))
+        || !cache_section(cache, cache->tokens, cache->tok_count,
+            sizeof(AST_Token))
+        || !cache_section(cache, cache->idents, cache->ident_count,
+            sizeof(uint32_t))
+        || !cache_section(cache, cache->strings, cache->string_count,
+            sizeof(uint32_t)) ) {
+        return false;
+    }
+
+    const char* base = (const char*)cache;
+    const uint32_t* idents = (const uint32_t*)&base[cache->idents];
+    for ( size_t i = 0; i < cache->ident_count; i++ ) {
+        if ( len <= idents[i] ) { return false; }
+    }
+    const uint32_t* strings = (const uint32_t*)&base[cache->strings];
+    for ( size_t i = 0; i < cache->string_count; i++ ) {
+        if ( strings[i] % 8 != 0 || len - sizeof(Span_String) < strings[i]
+            || len - sizeof(Span_String) - strings[i]
+                < ((const Span_String*)&base[strings[i]])->size ) {
+            return false;
+        }
+    }
+    return base[len - 1] == '\0';
+}
+
+// NOTE: on a hit the tree is the mapping itself, nothing is copied
+int ast_cache_load(AST* ast)
+{
+    { // sanity check
+        ASSERT(ast != NULL);
+        ASSERT(ast->cache_dir != NULL);
+        ASSERT(ast->cache == NULL);
+    }
+
+    if ( !cache_key(ast) ) { return false; }
+
+    char path[PATH_MAX];
+    cache_path(ast, path, sizeof(path));
+    const int fd = open(path, O_RDONLY);
+    if ( fd == -1 ) {
+        LOG_INFOF(LOG_AST, "cache: miss %s", path);
+        return false;
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if ( fstat(fd, &st) == 0 && sizeof(AST_Cache) <= (size_t)st.st_size
+        && (size_t)st.st_size <= UINT32_MAX ) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if ( map == MAP_FAILED ) {
+        LOG_WARNF("cache: can't map %s", path);
+        return false;
+    }
+
+    const AST_Cache* cache = map;
+    if ( !cache_valid(cache, ast, st.st_size) ) {
+        LOG_WARNF("cache: %s is stale or corrupt, ignored", path);
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    const char* base = map;
+    ast->cache = cache;
+    ast->root = AST_NULL;
+    ast->nodes = (AST_Node*)&base[cache->nodes];
+    ast->node_count = cache->node_count;
+    ast->node_cap = 0;
+    ast->tok_table = (AST_Token*)&base[cache->tokens];
+    ast->tok_count = cache->tok_count;
+    ast->tok_cap = 0;
+    LOG_INFOF(LOG_AST, "cache: hit %s, %zu nodes", path, ast->node_count);
+    return true;
+}
+
+// NOTE: the file is built in memory and renamed into place, so concurrent
+//       builds never see half of one
+int ast_cache_store(AST* ast)
+{
+    { // sanity check
+        ASSERT(ast != NULL);
+        ASSERT(ast->cache_dir != NULL);
+        ASSERT(ast->cache == NULL);
+    }
+
+    if ( !cache_key(ast) ) { return false; }
+
+    const Null_Pool* ids = ast->identifiers;
+    const Span_Pool* strs = ast->strings;
+    AST_Cache head = {
+        .magic = AST_CACHE_MAGIC,
+        .key = ast->cache_key,
+        .src_len = ast->tok->scanner.src_len,
+        .node_count = (uint32_t)ast->node_count,
+        .tok_count = (uint32_t)ast->tok_count,
+        .ident_count = (uint32_t)ids->count,
+        .string_count = (uint32_t)strs->count,
+    };
+    size_t size = sizeof(AST_Cache);
+    head.nodes = (uint32_t)size;
+    size += sizeof(AST_Node) * ast->node_count;
+    head.tokens = (uint32_t)size;
+    size += sizeof(AST_Token) * ast->tok_count;
+    head.idents = (uint32_t)size;
+    size += sizeof(uint32_t) * ids->count;
+    head.strings = (uint32_t)size;
+    size += sizeof(uint32_t) * strs->count;
+    size = DATA_ROUND_UP(size, 8);
+    const size_t text = size;
+    for ( size_t i = 0; i < ids->count; i++ ) {
+        size += ids->atoms[i].len + 1;
+    }
+    size = DATA_ROUND_UP(size, 8);
+    const size_t spans = size;
+    for ( size_t i = 0; i < strs->count; i++ ) {
+        const size_t n = sizeof(Span_String) + strs->strings[i]->size + 1;
+        size += DATA_ROUND_UP(n, 8);
+    }
+    size += (size == spans); // NOTE: ends with a '\0' either way
+    if ( UINT32_MAX < size ) {
+        LOG_WARN("cache: tree too big for the cache, not stored");
+        return false;
+    }
+    head.size = (uint32_t)size;
+
+    char* buff = mem_calloc(MEM_AST, 1, size);
+    if ( buff == NULL ) {
+        LOG_WARN("cache: out of memory, not stored");
+        return false;
+    }
+    { // fill
+        memcpy(buff, &head, sizeof(head));
+        memcpy(&buff[head.nodes], ast->nodes,
+            sizeof(AST_Node) * ast->node_count);
+        memcpy(&buff[head.tokens], ast->tok_table,
+            sizeof(AST_Token) * ast->tok_count);
+
+        uint32_t* idents = (uint32_t*)&buff[head.idents];
+        size_t off = text;
+        for ( size_t i = 0; i < ids->count; i++ ) {
+            idents[i] = (uint32_t)off;
+            memcpy(&buff[off], ids->atoms[i].str, ids->atoms[i].len);
+            off += ids->atoms[i].len + 1;
+        }
+        uint32_t* strings = (uint32_t*)&buff[head.strings];
+        off = spans;
+        for ( size_t i = 0; i < strs->count; i++ ) {
+            const Span_String* span = strs->strings[i];
+            strings[i] = (uint32_t)off;
+            memcpy(&buff[off], span, sizeof(Span_String) + span->size);
+            off += DATA_ROUND_UP(sizeof(Span_String) + span->size + 1, 8);
+        }
+    }
+
+    char path[PATH_MAX], tmp[PATH_MAX + 32];
+    cache_path(ast, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+    if ( mkdir(ast->cache_dir, 0755) == -1 && errno != EEXIST ) {
+        LOG_WARNF("cache: can't create %s: %s", ast->cache_dir,
+            strerror(errno));
+        mem_free(buff);
+        return false;
+    }
+
+    int ok = false;
+    FILE* out = fopen(tmp, "wb");
+    if ( out != NULL ) {
+        ok = fwrite(buff, 1, size, out) == size;
+        ok = (fclose(out) == 0) && ok;
+        ok = ok && rename(tmp, path) == 0;
+        if ( !ok ) { remove(tmp); }
+    }
+    if ( ok ) {
+        LOG_INFOF(LOG_AST, "cache: stored %s, %zu bytes", path, size);
+    } else {
+        LOG_WARNF("cache: can't write %s", path);
+    }
+    mem_free(buff);
+    return ok;
+}
@@ -0,0 +1,393 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "config.h"
+#include "utils.h"
+
+// NOTE: the program is straight-line code, so one pass forward knows the
+//       value of every local at every statement (folding as it goes) and one
+//       pass backward knows which of them are ever read again. nothing that
+//       could trap (a division by a zero or unknown value) or that codegen
+//       rejects (an undeclared local) is folded nor removed, it runs and
+//       fails the same way.
+
+typedef enum {
+    VAR_UNDECLARED,
+    VAR_UNKNOWN, // only known at run time
+    VAR_CONST,
+} var_state_t;
+
+// a local, by atom
+typedef struct Opt_Var_s {
+    uint8_t state; // var_state_t, forward pass
+    uint8_t assigned; // backward pass: a kept assignment follows
+    uint8_t _pad[2];
+    uint32_t value; // VAR_CONST
+    uint32_t live; // backward pass: read later on if it's the current epoch
+} Opt_Var;
+
+typedef enum {
+    STMT_PINNED = 1 << 0, // kept even if dead
+    STMT_DEAD = 1 << 1,
+} stmt_flag_t;
+
+typedef struct Opt_Frame_s {
+    ast_ref_t ref;
+    uint32_t done;
+} Opt_Frame;
+
+typedef struct Opt_s {
+    AST* ast;
+    Opt_Var* vars;
+    size_t var_cap;
+    Opt_Frame* frames;
+    size_t frame_cap;
+    ast_ref_t* stmts;
+    uint8_t* flags; // stmt_flag_t, by statement
+    size_t stmt_count;
+    size_t stmt_cap;
+    uint32_t epoch;
+    size_t folded;
+    size_t removed;
+} Opt;
+
+static void* opt_grow(void* data, size_t* cap, size_t need, size_t size)
+{
+    if ( need <= *cap ) { return data; }
+
+    size_t new_cap = (*cap == 0) ? AST_BUFF_SIZE : *cap;
+    while ( new_cap < need ) { new_cap *= 2; }
+    void* ptr = mem_realloc(MEM_AST, data, size * new_cap);
+    if ( ptr == NULL ) {
+        LOG_ERR("out of memory");
+        exit(EXIT_FAILURE);
+    }
+    *cap = new_cap;
+    return ptr;
+}
+
+static Opt_Var* opt_var(Opt* opt, atom_t atom)
+{
+    if ( opt->var_cap <= atom ) {
+        const size_t cap = opt->var_cap;
+        opt->vars = opt_grow(opt->vars, &opt->var_cap, atom + 1,
+            sizeof(Opt_Var));
+        memset(&opt->vars[cap], 0, sizeof(Opt_Var) * (opt->var_cap - cap));
+    }
+    return &opt->vars[atom];
+}
+
+// NOTE: a cached tree is a read-only mapping, the pass edits a copy of it
+static void opt_own(AST* ast)
+{
+    if ( ast->cache == NULL || ast->node_cap != 0 ) { return; }
+
+    AST_Node* nodes = mem_alloc(MEM_AST, sizeof(AST_Node) * ast->node_count);
+    AST_Token* toks = mem_alloc(MEM_AST, sizeof(AST_Token) * ast->tok_count);
+    if ( nodes == NULL || toks == NULL ) {
+        LOG_ERR("out of memory");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(nodes, ast->nodes, sizeof(AST_Node) * ast->node_count);
+    memcpy(toks, ast->tok_table, sizeof(AST_Token) * ast->tok_count);
+    ast->nodes = nodes;
+    ast->node_cap = ast->node_count;
+    ast->tok_table = toks;
+    ast->tok_cap = ast->tok_count;
+}
+
+/*****************************************************************************/
+/* [F]olding *****************************************************************/
+/*****************************************************************************/
+
+// NOTE: same results as the generated code: 32 bit wrap around, shifts by
+//       the low 5 bits, >> is arithmetic. false if it would trap.
+static int opt_eval(ast_node_t tag, uint32_t a, uint32_t b, uint32_t* out)
+{
+    const int32_t sa = (int32_t)a, sb = (int32_t)b;
+    switch ( tag ) {
+        case AST_OP_ADD: *out = a + b; break;
+        case AST_OP_SUB: *out = a - b; break;
+        case AST_OP_MUL: *out = a * b; break;
+        case AST_OP_DIV:
+        case AST_OP_MOD:
+            if ( sb == 0 || (sa == INT32_MIN && sb == -1) ) { return false; }
+            *out = (uint32_t)((tag == AST_OP_DIV) ? sa / sb : sa % sb);
+            break;
+        case AST_OP_SHL: *out = a << (b & 31); break;
+        case AST_OP_SHR:
+            *out = (sa < 0) ? ~(~a >> (b & 31)) : a >> (b & 31);
+            break;
+        case AST_OP_LT:   *out = sa < sb; break;
+        case AST_OP_GT:   *out = sa > sb; break;
+        case AST_OP_LE:   *out = sa <= sb; break;
+        case AST_OP_GE:   *out = sa >= sb; break;
+        case AST_OP_EQ:   *out = a == b; break;
+        case AST_OP_NE:   *out = a != b; break;
+        case AST_OP_AND:  *out = a & b; break;
+        case AST_OP_XOR:  *out = a ^ b; break;
+        case AST_OP_OR:   *out = a | b; break;
+        case AST_OP_NEG:  *out = 0u - a; break;
+        case AST_OP_NOT:  *out = a == 0; break;
+        case AST_OP_BNOT: *out = ~a; break;
+        default:          return false;
+    }
+    return true;
+}
+
+// turns ref into a literal, its token (its own) becomes the integer
+static void opt_set_lit(Opt* opt, ast_ref_t ref, uint32_t value)
+{
+    AST_Node* node = &opt->ast->nodes[ref];
+    { // sanity check
+        ASSERT(node->token != 0);
+    }
+    AST_Token* tok = &opt->ast->tok_table[node->token];
+    node->tag = AST_LIT_INT;
+    node->first_child = AST_NULL;
+    tok->type = TOK_INTEGER;
+    tok->value = value;
+    opt->folded++;
+}
+static int opt_is_lit(const Opt* opt, ast_ref_t ref)
+{
+    return ref != AST_NULL && ast_node(opt->ast, ref)->tag == AST_LIT_INT;
+}
+
+// an operator whose operands are done
+static int opt_fold_op(Opt* opt, ast_ref_t ref)
+{
+    const AST* ast = opt->ast;
+    const AST_Node* node = ast_node(ast, ref);
+    const ast_ref_t lhs = node->first_child;
+    const ast_ref_t rhs = ast_node(ast, lhs)->next_sibling;
+    const int divides = node->tag == AST_OP_DIV || node->tag == AST_OP_MOD;
+
+    const int known
+        = opt_is_lit(opt, lhs) && (rhs == AST_NULL || opt_is_lit(opt, rhs));
+    if ( !known ) {
+        if ( !divides ) { return true; }
+        // NOTE: a known divisor other than 0 and -1 can't trap
+        const int32_t d = opt_is_lit(opt, rhs)
+            ? (int32_t)ast_token(ast, rhs)->value : 0;
+        return d != 0 && d != -1;
+    }
+    const uint32_t a = ast_token(ast, lhs)->value;
+    const uint32_t b = (rhs != AST_NULL) ? ast_token(ast, rhs)->value : 0;
+    uint32_t value;
+    if ( !opt_eval(node->tag, a, b, &value) ) { return false; }
+    opt_set_lit(opt, ref, value);
+    return true;
+}
+
+// NOTE: folds the AST_EXPR expr bottom up with the known locals, on an
+//       explicit stack like gen_expr. false if what's left may trap or reads
+//       an undeclared local.
+static int opt_fold(Opt* opt, ast_ref_t expr)
+{
+    AST* ast = opt->ast;
+    const ast_ref_t first = ast_node(ast, expr)->first_child;
+    if ( first == AST_NULL ) { return false; } // NOTE: codegen reports it
+
+    int safe = true;
+    size_t len = 0;
+    opt->frames = opt_grow(opt->frames, &opt->frame_cap, 1, sizeof(Opt_Frame));
+    opt->frames[len++] = (Opt_Frame) { .ref = first };
+    while ( len != 0 ) {
+        const ast_ref_t ref = opt->frames[len - 1].ref;
+        const AST_Node* node = ast_node(ast, ref);
+
+        if ( node->first_child == AST_NULL ) { // leaf
+            len--;
+            if ( node->tag != AST_IDENT ) { continue; }
+            const Opt_Var* var = opt_var(opt, ast_token(ast, ref)->value);
+            if ( var->state == VAR_CONST ) {
+                opt_set_lit(opt, ref, var->value);
+            } else if ( var->state == VAR_UNDECLARED ) {
+                safe = false;
+            }
+        } else if ( opt->frames[len - 1].done == 0 ) {
+            opt->frames[len - 1].done = 1;
+            ast_foreach_child(ast, ref, child)
+            {
+                opt->frames = opt_grow(
+                    opt->frames, &opt->frame_cap, len + 1, sizeof(Opt_Frame));
+                opt->frames[len++] = (Opt_Frame) { .ref = child };
+            }
+        } else {
+            len--;
+            safe = opt_fold_op(opt, ref) && safe;
+        }
+    }
+    return safe;
+}
+
+// what the local id holds after it's set to expr (AST_NULL: never set)
+static void opt_bind(Opt* opt, atom_t id, ast_ref_t expr)
+{
+    const ast_ref_t value
+        = (expr != AST_NULL) ? ast_node(opt->ast, expr)->first_child : AST_NULL;
+    Opt_Var* var = opt_var(opt, id);
+    if ( expr == AST_NULL ) { // NOTE: a local never set reads as 0
+        *var = (Opt_Var) { .state = VAR_CONST, .value = 0 };
+    } else if ( opt_is_lit(opt, value) ) {
+        *var = (Opt_Var) { .state = VAR_CONST,
+            .value = ast_token(opt->ast, value)->value };
+    } else {
+        *var = (Opt_Var) { .state = VAR_UNKNOWN };
+    }
+}
+
+static void opt_forward(Opt* opt)
+{
+    const AST* ast = opt->ast;
+    for ( size_t i = 0; i < opt->stmt_count; i++ ) {
+        const ast_ref_t stmt = opt->stmts[i];
+        const AST_Node* node = ast_node(ast, stmt);
+        const atom_t id = ast_token(ast, stmt)->value;
+        const ast_ref_t expr = (node->tag == AST_DECL)
+            ? ast_child(ast, stmt, 1) // skip type
+            : node->first_child;
+        const int safe = expr == AST_NULL || opt_fold(opt, expr);
+        opt->flags[i] = safe ? 0 : STMT_PINNED;
+
+        switch ( node->tag ) {
+            case AST_DECL: opt_bind(opt, id, expr); break;
+            case AST_ASSIGN:
+                if ( opt_var(opt, id)->state == VAR_UNDECLARED ) {
+                    opt->flags[i] = STMT_PINNED;
+                    break;
+                }
+                opt_bind(opt, id, expr);
+                break;
+            case AST_RETURN: break;
+            default:         opt->flags[i] = STMT_PINNED; break;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* [D]ead locals *************************************************************/
+/*****************************************************************************/
+
+// the locals expr reads are live
+static void opt_reads(Opt* opt, ast_ref_t expr)
+{
+    if ( expr == AST_NULL ) { return; }
+
+    const AST* ast = opt->ast;
+    size_t len = 0;
+    opt->frames = opt_grow(opt->frames, &opt->frame_cap, 1, sizeof(Opt_Frame));
+    opt->frames[len++] = (Opt_Frame) { .ref = expr };
+    while ( len != 0 ) {
+        const ast_ref_t ref = opt->frames[--len].ref;
+        if ( ast_node(ast, ref)->tag == AST_IDENT ) {
+            opt_var(opt, ast_token(ast, ref)->value)->live = opt->epoch;
+        }
+        ast_foreach_child(ast, ref, child)
+        {
+            opt->frames = opt_grow(
+                opt->frames, &opt->frame_cap, len + 1, sizeof(Opt_Frame));
+            opt->frames[len++] = (Opt_Frame) { .ref = child };
+        }
+    }
+}
+
+// NOTE: a value nobody reads before it's set again (or the program returns)
+//       is dead. a dead declaration that a kept assignment still needs only
+//       loses its value.
+static void opt_backward(Opt* opt)
+{
+    AST* ast = opt->ast;
+    for ( size_t i = 0; i < opt->var_cap; i++ ) {
+        opt->vars[i].assigned = false;
+        opt->vars[i].live = 0;
+    }
+    opt->epoch = 1;
+
+    for ( size_t i = opt->stmt_count; 0 < i; i-- ) {
+        const ast_ref_t stmt = opt->stmts[i - 1];
+        AST_Node* node = &ast->nodes[stmt];
+        if ( node->tag == AST_RETURN ) {
+            opt->epoch++; // NOTE: nothing after it runs
+            opt_reads(opt, node->first_child);
+            continue;
+        }
+        if ( node->tag != AST_DECL && node->tag != AST_ASSIGN ) { // pinned
+            opt_reads(opt, node->first_child);
+            continue;
+        }
+
+        Opt_Var* var = opt_var(opt, ast_token(ast, stmt)->value);
+        const int dead
+            = !(opt->flags[i - 1] & STMT_PINNED) && var->live != opt->epoch;
+        var->live = 0;
+        if ( node->tag == AST_ASSIGN ) {
+            if ( dead ) {
+                opt->flags[i - 1] |= STMT_DEAD;
+                continue;
+            }
+            var->assigned = true;
+            opt_reads(opt, node->first_child);
+            continue;
+        }
+
+        const ast_ref_t type = node->first_child;
+        if ( !dead ) {
+            opt_reads(opt, ast_node(ast, type)->next_sibling);
+        } else if ( var->assigned ) {
+            ast->nodes[type].next_sibling = AST_NULL;
+        } else {
+            opt->flags[i - 1] |= STMT_DEAD;
+        }
+        var->assigned = false;
+    }
+}
+
+// relinks the statements left under the root
+static void opt_unlink(Opt* opt)
+{
+    AST* ast = opt->ast;
+    ast_ref_t* link = &ast->nodes[ast->root].first_child;
+    for ( size_t i = 0; i < opt->stmt_count; i++ ) {
+        if ( opt->flags[i] & STMT_DEAD ) {
+            opt->removed++;
+            continue;
+        }
+        *link = opt->stmts[i];
+        link = &ast->nodes[opt->stmts[i]].next_sibling;
+    }
+    *link = AST_NULL;
+}
+
+void ast_optimize(AST* ast)
+{
+    { // sanity check
+        ASSERT(ast != NULL);
+        ASSERT(ast->nodes != NULL);
+    }
+
+    opt_own(ast);
+    Opt opt = { .ast = ast };
+    ast_foreach_child(ast, ast->root, stmt)
+    {
+        opt.stmts = opt_grow(
+            opt.stmts, &opt.stmt_cap, opt.stmt_count + 1, sizeof(ast_ref_t));
+        opt.stmts[opt.stmt_count++] = stmt;
+    }
+    size_t flag_cap = 0;
+    opt.flags = opt_grow(NULL, &flag_cap, opt.stmt_count, sizeof(uint8_t));
+
+    opt_forward(&opt);
+    opt_backward(&opt);
+    opt_unlink(&opt);
+    LOG_INFOF(LOG_AST, "opt: %zu nodes folded, %zu statements removed",
+        opt.folded, opt.removed);
+
+    mem_free(opt.vars);
+    mem_free(opt.frames);
+    mem_free(opt.stmts);
+    mem_free(opt.flags);
+}
@@ -4,7 +4,14 @@
 #include <stdio.h>
 
 #include "ast.h"
+#include "string_pool.h"
 
-extern void code_gen_main(FILE* out, AST_Node* root);
+extern void code_gen_main(FILE* out, Context* ctx, const AST* ast);
+// same code as an ELF64 relocatable object, see object.h
+extern void code_gen_object(FILE* out, Context* ctx, const AST* ast);
+// same code as a static ELF64 executable, with its own _start
+extern void code_gen_exe(FILE* out, Context* ctx, const AST* ast);
+// same code run in process (see jit.h), returns the result of main
+extern int code_gen_run(Context* ctx, const AST* ast);
 
 #endif // !_CODEGEN_H
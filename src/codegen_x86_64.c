@@ -1,201 +1,221 @@
-
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "./ast.h"
 #include "./codegen.h"
+#include "emit.h"
+#include "ir.h"
+#include "jit.h"
+#include "object.h"
 #include "utils.h"
 
-// grep "^void " ./src/codegen_x86_64.c
-extern void gen_binop(FILE* out, AST_Node* node, const char* op_instr);
-extern void gen_expr(FILE* out, AST_Node* node);
-extern void gen_stmt(FILE* out, AST_Node* node);
-extern void code_gen_main(FILE* out, AST_Node* root);
+// grep "^void \|^Ir_Value " ./src/codegen_x86_64.c
+extern Ir_Value gen_expr(const AST* ast, ast_ref_t ref);
+extern void gen_stmt(const AST* ast, ast_ref_t ref);
+extern void gen_binop(Emitter* e, const Ir_Instr* instr);
+extern void gen_unop(Emitter* e, const Ir_Instr* instr);
+extern void gen_rodata(Emitter* e, const AST* ast);
+extern void gen_rodata_code(Emitter* e, const AST* ast);
+extern void code_gen_main(FILE* out, Context* ctx, const AST* ast);
+extern void code_gen_object(FILE* out, Context* ctx, const AST* ast);
+extern void code_gen_exe(FILE* out, Context* ctx, const AST* ast);
+extern int code_gen_run(Context* ctx, const AST* ast);
 
 
 #define INIT_CAP 16
-typedef struct Symbol_s {
-    void* id;
-    int offset;
-} Symbol;
-
+// NOTE: indexed by atom, the current value of each local (IR_VAL_NONE: not
+//       declared)
 typedef struct Symbol_Tab_s {
+    Context* ctx;
     size_t cap;
-    size_t len;
-    Symbol* entries;
+    size_t bytes; // carved from ctx, every grow leaves the old copy behind
+    Ir_Value* values;
 } Symbol_Tab;
 
-static void st_init(Symbol_Tab* tab);
+static void st_init(Symbol_Tab* tab, Context* ctx);
 static void st_free(Symbol_Tab* tab);
-static void st_put(Symbol_Tab* tab, void* id, int offset);
-static int st_get(const Symbol_Tab* tab, void* id);
-static void st_grow(Symbol_Tab* tab);
+static void st_put(Symbol_Tab* tab, atom_t id, Ir_Value value);
+static Ir_Value st_get(const Symbol_Tab* tab, atom_t id);
+static void st_grow(Symbol_Tab* tab, atom_t id);
 
-void st_init(Symbol_Tab* tab)
+void st_init(Symbol_Tab* tab, Context* ctx)
 {
+    tab->ctx = ctx;
     tab->cap = INIT_CAP;
-    tab->len = 0;
-    tab->entries = malloc(sizeof(Symbol) * tab->cap);
+    tab->bytes = sizeof(Ir_Value) * tab->cap;
+    tab->values = mem_context_alloc(ctx, MEM_SYMTAB, tab->bytes);
+    ASSERT(tab->values != NULL);
+    memset(tab->values, 0, sizeof(Ir_Value) * tab->cap);
 }
 
+// NOTE: the values go away with the context
 void st_free(Symbol_Tab* tab)
 {
-    free(tab->entries);
-    tab->entries = NULL;
-    tab->len = 0;
+    mem_context_release(MEM_SYMTAB, tab->bytes);
+    tab->bytes = 0;
+    tab->values = NULL;
     tab->cap = 0;
 }
 
-void st_grow(Symbol_Tab* tab)
+void st_grow(Symbol_Tab* tab, atom_t id)
 {
-    tab->cap *= 2;
-    tab->entries = realloc(tab->entries, sizeof(Symbol) * tab->cap);
+    size_t cap = tab->cap;
+    while ( cap <= id ) { cap *= 2; }
+    Ir_Value* values
+        = mem_context_alloc(tab->ctx, MEM_SYMTAB, sizeof(Ir_Value) * cap);
+    ASSERT(values != NULL);
+    tab->bytes += sizeof(Ir_Value) * cap;
+    memcpy(values, tab->values, sizeof(Ir_Value) * tab->cap);
+    memset(&values[tab->cap], 0, sizeof(Ir_Value) * (cap - tab->cap));
+    tab->values = values;
+    tab->cap = cap;
 }
-void st_put(Symbol_Tab* tab, void* id, int offset)
+void st_put(Symbol_Tab* tab, atom_t id, Ir_Value value)
 {
-    for ( size_t i = 0; i < tab->len; ++i ) {
-        if ( tab->entries[i].id == id ) {
-            tab->entries[i].offset = offset;
-            return;
-        }
-    }
-
-    if ( tab->len == tab->cap ) { st_grow(tab); }
-
-    tab->entries[tab->len].id = id;
-    tab->entries[tab->len].offset = offset;
-    tab->len++;
+    if ( tab->cap <= id ) { st_grow(tab, id); }
+    tab->values[id] = value;
 }
 
-int st_get(const Symbol_Tab* tab, void* id)
+Ir_Value st_get(const Symbol_Tab* tab, atom_t id)
 {
-    for ( size_t i = 0; i < tab->len; ++i ) {
-        if ( tab->entries[i].id == id ) { return tab->entries[i].offset; }
+    if ( id < tab->cap && tab->values[id].kind != IR_VAL_NONE ) {
+        return tab->values[id];
     }
-    LOG_ERRF("undeclared symbol (%p)...", id);
+    LOG_ERRF("undeclared symbol (atom %u)...", id);
     TODO("PRINT MSG");
-    return 0; // TODO: return -1 if not found and print a not declared error if
-              // necessary...
+    return IR_IMM(0); // TODO: print a not declared error if necessary...
 }
 
 // TODO: move this globals...
-// we could use a stack to place scopes and their offsets...
-static int temp_offset = 0;
+// we could use a stack to place scopes and their values...
 static Symbol_Tab symtab;
+static Ir ir;
 
-void gen_binop(FILE* out, AST_Node* node, const char* op_instr)
-{
-    // left
-    gen_expr(out, node->children[0]);
-    fprintf(out, "    push %%rax\n");
+/*****************************************************************************/
+/* [L]owering ****************************************************************/
+/*****************************************************************************/
 
-    // right
-    gen_expr(out, node->children[1]);
-    fprintf(out, "    movl %%eax, %%ebx\n");
-    fprintf(out, "    pop %%rax\n");
+// NOTE: the AST is lowered to the vreg form of ir.h first, the registers are
+//       picked over the whole program and then each instruction is emitted
+//       with its operands wherever they ended up.
 
-    fprintf(out, "    %s %%ebx, %%eax\n", op_instr);
+// primary as an operand, no code
+static Ir_Value gen_primary(const AST* ast, ast_ref_t ref)
+{
+    const AST_Token* tok = ast_token(ast, ref);
+    switch ( ast_node(ast, ref)->tag ) {
+        case AST_LIT_INT: return IR_IMM((uint32_t)tok->value);
+        case AST_IDENT:
+            LOG_TRACEF(LOG_GEN, "load [%s]", ast_ident(ast, tok->value));
+            return st_get(&symtab, tok->value);
+        default:
+            fprintf(stderr, "Unexpected node in primary position: %d\n",
+                ast_node(ast, ref)->tag);
+            exit(1);
+    }
 }
 
-void gen_expr(FILE* out, AST_Node* node)
+// NOTE: post-order walk over an explicit stack, a machine generated
+//       expression is as deep as it is long. done counts the children
+//       already evaluated, a binary op keeps its lhs while the rhs is.
+typedef struct Gen_Frame_s {
+    ast_ref_t ref;
+    uint32_t done;
+    Ir_Value lhs;
+} Gen_Frame;
+static Gen_Frame* frames = NULL;
+static size_t frame_cap = 0;
+
+static void gen_frame_push(size_t* len, ast_ref_t ref)
 {
+    if ( *len == frame_cap ) {
+        const size_t cap = (frame_cap == 0) ? 64 : frame_cap * 2;
+        Gen_Frame* ptr = mem_realloc(MEM_GEN, frames, sizeof(Gen_Frame) * cap);
+        ASSERT(ptr != NULL);
+        frames = ptr;
+        frame_cap = cap;
+    }
+    frames[(*len)++] = (Gen_Frame) { .ref = ref, .done = 0 };
+}
+Ir_Value gen_expr(const AST* ast, ast_ref_t ref)
+{
+    const AST_Node* node = ast_node(ast, ref);
     if ( node->tag != AST_EXPR ) {
         // TODO: prety print
         fprintf(stderr, "Expected AST_EXPR as top-level in gen_expr\n");
         exit(1);
     }
 
-    if ( node->child_count == 0 ) {
+    if ( node->first_child == AST_NULL ) {
         fprintf(stderr, "Empty expression node\n");
         exit(1);
     }
 
-    AST_Node* lhs = node->children[0];
-
-    switch ( lhs->tag ) {
-        case AST_LIT_INT:
-            fprintf(out, "    movl $%zu, %%eax\n", lhs->tok.rep.num);
-            break;
-        case AST_IDENT:
-            printf("[%s]\n", lhs->tok.rep.str);
-            fprintf(out, "    movl -%d(%%rbp), %%eax\n",
-                st_get(&symtab, lhs->tok.rep.id));
-            break;
-        default:
-            fprintf(
-                stderr, "Unexpected node in primary position: %d\n", lhs->tag);
-            exit(1);
-    }
-
-    for ( size_t i = 1; i < node->child_count; i += 2 ) {
-        AST_Node* op = node->children[i];
-        AST_Node* rhs = node->children[i + 1];
-
-        // Push current %eax (result of lhs so far)
-        fprintf(out, "    push %%rax\n");
-
-        // Evaluate rhs into %eax
-        switch ( rhs->tag ) {
-            case AST_LIT_INT:
-                fprintf(out, "    movl $%zu, %%eax\n", rhs->tok.rep.num);
-                break;
-            case AST_IDENT:
-                fprintf(out, "    movl -%d(%%rbp), %%eax\n",
-                    st_get(&symtab, rhs->tok.rep.id));
-                break;
-            default:
-                fprintf(stderr, "Unexpected RHS node: %d\n", rhs->tag);
-                exit(1);
+    Ir_Value value = { .kind = IR_VAL_NONE }; // of the last node done
+    size_t len = 0;
+    gen_frame_push(&len, node->first_child);
+    while ( len != 0 ) {
+        Gen_Frame* frame = &frames[len - 1];
+        const AST_Node* op = ast_node(ast, frame->ref);
+
+        if ( op->first_child == AST_NULL ) { // leaf
+            value = gen_primary(ast, frame->ref);
+            len--;
+            continue;
         }
-
-        // Move RHS into %ebx for the operation
-        fprintf(out, "    movl %%eax, %%ebx\n");
-
-        // Pop lhs back into %eax
-        fprintf(out, "    pop %%rax\n");
-
-        // Apply the operation
-        switch ( op->tag ) {
-            case AST_OP_ADD: fprintf(out, "    addl %%ebx, %%eax\n"); break;
-            case AST_OP_MUL: fprintf(out, "    imull %%ebx, %%eax\n"); break;
-            default:
+        const ast_ref_t rhs = ast_node(ast, op->first_child)->next_sibling;
+        if ( frame->done == 0 ) {
+            frame->done = 1;
+            gen_frame_push(&len, op->first_child);
+        } else if ( rhs == AST_NULL ) { // unary
+            if ( op->tag < AST_OP_NEG || AST_OP_BNOT < op->tag ) {
+                fprintf(stderr, "Unknown unary operator: %d\n", op->tag);
+                exit(1);
+            }
+            value = ir_push(&ir, IR_UNOP, op->tag, value, IR_IMM(0));
+            len--;
+        } else if ( frame->done == 1 ) {
+            frame->done = 2;
+            frame->lhs = value;
+            gen_frame_push(&len, rhs);
+        } else {
+            if ( op->tag < AST_OP_ADD || AST_OP_OR < op->tag ) {
                 fprintf(stderr, "Unknown binary operator: %d\n", op->tag);
                 exit(1);
+            }
+            value = ir_push(&ir, IR_BINOP, op->tag, frame->lhs, value);
+            len--;
         }
     }
+    return value;
 }
 
-void gen_stmt(FILE* out, AST_Node* node)
+void gen_stmt(const AST* ast, ast_ref_t ref)
 {
+    const AST_Node* node = ast_node(ast, ref);
+    const atom_t id = ast_token(ast, ref)->value;
     switch ( node->tag ) {
         case AST_DECL: {
-            AST_Node* expr = node->children[1]; // skip type
-
-            temp_offset += 4;
-            st_put(&symtab, node->tok.rep.id, temp_offset);
-            printf(
-                "`-> DECL: id:%p -> off:%d\n", node->tok.rep.id, temp_offset);
-
-            if ( expr != NULL ) {
-                gen_expr(out, expr);
-                fprintf(out, "    movl %%eax, -%d(%%rbp)\n", temp_offset);
-            }
-
+            ast_ref_t expr = ast_child(ast, ref, 1); // skip type
+
+            // NOTE: a local never set reads as 0
+            const Ir_Value value
+                = (expr != AST_NULL) ? gen_expr(ast, expr) : IR_IMM(0);
+            st_put(&symtab, id, value);
+            LOG_DEBUGF(LOG_GEN, "`-> DECL: atom:%u -> %s %u", id,
+                IR_IS_VREG(value) ? "vreg" : "imm", value.value);
             break;
         }
         case AST_ASSIGN: {
-            AST_Node* expr = node->children[0]; // skip type
-
-            gen_expr(out, expr);
-            fprintf(out, "    movl %%eax, -%d(%%rbp)\n",
-                st_get(&symtab, node->tok.rep.id));
+            st_get(&symtab, id); // NOTE: declared
+            st_put(&symtab, id, gen_expr(ast, node->first_child));
             break;
         }
         case AST_RETURN: {
-            gen_expr(out, node->children[0]); // result in %eax
-            fprintf(out, "    mov %%rbp, %%rsp\n");
-            fprintf(out, "    pop %%rbp\n");
-            fprintf(out, "    ret\n");
+            const Ir_Value value = gen_expr(ast, node->first_child);
+            ir_push(&ir, IR_RET, 0, value, IR_IMM(0));
             break;
         }
         default:
@@ -204,28 +224,309 @@ void gen_stmt(FILE* out, AST_Node* node)
     }
 }
 
-void code_gen_main(FILE* out, AST_Node* root)
+/*****************************************************************************/
+/* [E]mission ****************************************************************/
+/*****************************************************************************/
+
+// NOTE: the registers ir_alloc hands out, all caller saved. %eax, %ecx and
+//       %edx are left out: idiv, the shifts and setcc want them, they're the
+//       scratch ones.
+static const reg_t gen_regs[] = {
+    REG_ESI, REG_EDI, REG_R8D, REG_R9D, REG_R10D, REG_R11D,
+};
+#define GEN_REG_COUNT (sizeof(gen_regs) / sizeof(gen_regs[0]))
+
+static const mnemonic_t binop_mnemonics[] = {
+    [AST_OP_ADD] = MN_ADDL,
+    [AST_OP_SUB] = MN_SUBL,
+    [AST_OP_MUL] = MN_IMULL,
+    [AST_OP_SHL] = MN_SALL,
+    [AST_OP_SHR] = MN_SARL,
+    [AST_OP_LT] = MN_SETL,
+    [AST_OP_GT] = MN_SETG,
+    [AST_OP_LE] = MN_SETLE,
+    [AST_OP_GE] = MN_SETGE,
+    [AST_OP_EQ] = MN_SETE,
+    [AST_OP_NE] = MN_SETNE,
+    [AST_OP_AND] = MN_ANDL,
+    [AST_OP_XOR] = MN_XORL,
+    [AST_OP_OR] = MN_ORL,
+};
+
+// where an operand is
+typedef enum {
+    LOC_IMM,
+    LOC_REG,
+    LOC_MEM, // disp(%rbp)
+} loc_t;
+typedef struct Gen_Loc_s {
+    loc_t kind;
+    reg_t reg;
+    int32_t disp;
+    uint32_t imm;
+} Gen_Loc;
+
+static Gen_Loc gen_loc(Ir_Value value)
+{
+    if ( !IR_IS_VREG(value) ) {
+        return (Gen_Loc) { .kind = LOC_IMM, .imm = value.value };
+    }
+    const int32_t loc = ir.locs[value.value];
+    if ( 0 <= loc ) {
+        return (Gen_Loc) { .kind = LOC_REG, .reg = gen_regs[loc] };
+    }
+    return (Gen_Loc) { .kind = LOC_MEM, .disp = -4 * (IR_SLOT(loc) + 1) };
+}
+static inline int gen_in(Gen_Loc loc, reg_t reg)
+{
+    return loc.kind == LOC_REG && loc.reg == reg;
+}
+
+// op src, dst
+static void gen_apply(Emitter* e, mnemonic_t op, Gen_Loc src, reg_t dst)
+{
+    switch ( src.kind ) {
+        case LOC_IMM: emit_op_ir(e, op, src.imm, dst); break;
+        case LOC_REG: emit_op_rr(e, op, src.reg, dst); break;
+        case LOC_MEM: emit_op_mr(e, op, src.disp, REG_RBP, dst); break;
+    }
+}
+static void gen_load(Emitter* e, Gen_Loc src, reg_t dst)
+{
+    if ( !gen_in(src, dst) ) { gen_apply(e, MN_MOVL, src, dst); }
+}
+// the result, from the register it was computed in
+static void gen_store(Emitter* e, reg_t src, Gen_Loc dst)
+{
+    if ( dst.kind == LOC_MEM ) {
+        emit_op_rm(e, MN_MOVL, src, dst.disp, REG_RBP);
+    } else if ( !gen_in(dst, src) ) {
+        emit_op_rr(e, MN_MOVL, src, dst.reg);
+    }
+}
+// operand in a register, the one it's in or %eax
+static reg_t gen_reg(Emitter* e, Gen_Loc src)
+{
+    if ( src.kind == LOC_REG ) { return src.reg; }
+    gen_load(e, src, REG_EAX);
+    return REG_EAX;
+}
+
+// NOTE: dst = a op b is computed into the register of dst (%eax if it was
+//       spilled), a and b may share it when they die here, so the one that
+//       the result overwrites has to be read first.
+void gen_binop(Emitter* e, const Ir_Instr* instr)
+{
+    Gen_Loc a = gen_loc(instr->a);
+    Gen_Loc b = gen_loc(instr->b);
+    const Gen_Loc dst = gen_loc((Ir_Value) { IR_VAL_VREG, instr->dst });
+    const reg_t d = (dst.kind == LOC_REG) ? dst.reg : REG_EAX;
+    const mnemonic_t op = binop_mnemonics[instr->tag];
+
+    switch ( instr->tag ) {
+        case AST_OP_DIV:
+        case AST_OP_MOD:
+            gen_load(e, a, REG_EAX);
+            if ( b.kind == LOC_IMM ) {
+                gen_load(e, b, REG_ECX);
+                b = (Gen_Loc) { .kind = LOC_REG, .reg = REG_ECX };
+            }
+            emit_op(e, MN_CLTD);
+            if ( b.kind == LOC_REG ) {
+                emit_op_r(e, MN_IDIVL, b.reg);
+            } else {
+                emit_op_m(e, MN_IDIVL, b.disp, REG_RBP);
+            }
+            gen_store(
+                e, (instr->tag == AST_OP_DIV) ? REG_EAX : REG_EDX, dst);
+            return;
+        case AST_OP_SHL:
+        case AST_OP_SHR:
+            if ( b.kind != LOC_IMM ) { gen_load(e, b, REG_ECX); }
+            gen_load(e, a, d);
+            if ( b.kind == LOC_IMM ) {
+                emit_op_ir(e, op, b.imm & 31, d);
+            } else {
+                emit_op_rr(e, op, REG_CL, d);
+            }
+            break;
+        case AST_OP_LT:
+        case AST_OP_GT:
+        case AST_OP_LE:
+        case AST_OP_GE:
+        case AST_OP_EQ:
+        case AST_OP_NE:
+            gen_apply(e, MN_CMPL, b, gen_reg(e, a));
+            emit_op_r(e, op, REG_AL);
+            emit_op_rr(e, MN_MOVZBL, REG_AL, d);
+            break;
+        case AST_OP_SUB:
+            if ( gen_in(b, d) && !gen_in(a, d) ) {
+                gen_load(e, b, REG_ECX);
+                b = (Gen_Loc) { .kind = LOC_REG, .reg = REG_ECX };
+            }
+            gen_load(e, a, d);
+            gen_apply(e, op, b, d);
+            break;
+        default: { // commutative
+            if ( gen_in(b, d) ) {
+                const Gen_Loc t = a;
+                a = b;
+                b = t;
+            }
+            gen_load(e, a, d);
+            gen_apply(e, op, b, d);
+            break;
+        }
+    }
+    if ( dst.kind == LOC_MEM ) { gen_store(e, REG_EAX, dst); }
+}
+void gen_unop(Emitter* e, const Ir_Instr* instr)
+{
+    const Gen_Loc a = gen_loc(instr->a);
+    const Gen_Loc dst = gen_loc((Ir_Value) { IR_VAL_VREG, instr->dst });
+    const reg_t d = (dst.kind == LOC_REG) ? dst.reg : REG_EAX;
+
+    if ( instr->tag == AST_OP_NOT ) {
+        const reg_t r = gen_reg(e, a);
+        emit_op_rr(e, MN_TESTL, r, r);
+        emit_op_r(e, MN_SETE, REG_AL);
+        emit_op_rr(e, MN_MOVZBL, REG_AL, d);
+    } else {
+        gen_load(e, a, d);
+        emit_op_r(e, (instr->tag == AST_OP_NEG) ? MN_NEGL : MN_NOTL, d);
+    }
+    if ( dst.kind == LOC_MEM ) { gen_store(e, REG_EAX, dst); }
+}
+
+// NOTE: one label per distinct literal (the pool dedups them), literal
+//       `id` is `.Lstr<id>`. the bytes are the raw source text between the
+//       quotes, so the escapes are left for gas to expand.
+void gen_rodata(Emitter* e, const AST* ast)
 {
-    st_init(&symtab);
+    const size_t count = ast_string_count(ast);
+    if ( count == 0 ) { return; }
+
+    emit_lit(e, "\n");
+    emit_lit(e, "# RODATA: \n");
+    emit_lit(e, ".section .rodata\n");
+    for ( size_t i = 0; i < count; ++i ) {
+        const Span_String* span = ast_string(ast, i);
+        emit_lit(e, ".Lstr");
+        emit_uint(e, span->id);
+        emit_lit(e, ":\n");
+        emit_lit(e, "    .asciz \"");
+        emit_str(e, span->str, span->size);
+        emit_lit(e, "\"\n");
+    }
+}
 
-    fprintf(out, "# HEAD: \n");
-    fprintf(out, ".global main\n");
-    fprintf(out, ".text\n\n");
-    fprintf(out, "main:\n");
-    fprintf(out, "    push %%rbp\n");
-    fprintf(out, "    mov %%rsp, %%rbp\n");
-    // TODO: change this stuff...
-    fprintf(out, "    sub $64, %%rsp  # Reserve some bytes\n");
+// NOTE: gas' rules for .asciz: \x takes every hex digit and keeps the low
+//       byte, up to 3 "octal" digits (8 and 9 too, times 8 all the same),
+//       an unknown escape is the char itself
+static size_t rodata_escape(Emitter* e, const char* str, size_t len)
+{
+    static const char plain[] = "bfnrtv";
+    static const char bytes[] = "\b\f\n\r\t\v";
+    const char c = str[1];
+    size_t i = 2;
+    if ( c == 'x' || c == 'X' ) {
+        unsigned value = 0;
+        for ( ; i < len && isxdigit((unsigned char)str[i]); i++ ) {
+            const unsigned d = (unsigned char)str[i];
+            value = value << 4 | (isdigit(d) ? d - '0' : (d | 32) - 'a' + 10);
+        }
+        emit_char(e, (char)value);
+    } else if ( isdigit((unsigned char)c) ) {
+        unsigned value = (unsigned)(c - '0');
+        for ( ; i < len && i < 4 && isdigit((unsigned char)str[i]); i++ ) {
+            value = value << 3 | (unsigned)(str[i] - '0');
+        }
+        emit_char(e, (char)value);
+    } else {
+        const char* p = strchr(plain, c);
+        emit_char(e, (p != NULL && c != '\0') ? bytes[p - plain] : c);
+    }
+    return i;
+}
+// the bytes gas makes of gen_rodata, in the same order
+void gen_rodata_code(Emitter* e, const AST* ast)
+{
+    const size_t count = ast_string_count(ast);
+    for ( size_t i = 0; i < count; ++i ) {
+        const Span_String* span = ast_string(ast, i);
+        size_t j = 0;
+        while ( j < span->size ) {
+            if ( span->str[j] != '\\' || j + 1 == span->size ) {
+                emit_char(e, span->str[j++]);
+            } else {
+                j += rodata_escape(e, &span->str[j], span->size - j);
+            }
+        }
+        emit_char(e, '\0');
+    }
+}
 
-    fprintf(out, "\n");
-    fprintf(out, "# CODE: \n");
-    printf("-----------------------------------------------------------\n");
-    for ( size_t i = 0; i < root->child_count; ++i ) {
-        fprintf(out, "    # [%zu]\n", i);
-        ast_print_node(root->children[i], 0);
-        gen_stmt(out, root->children[i]);
-        printf("-----------------------------------------------------------\n");
+// NOTE: the text of main or its code, by the mode of e. the frame is as big
+//       as the spill slots need.
+static void gen_main(Emitter* e, Context* ctx, const AST* ast)
+{
+    const int text = e->mode == EMIT_ASM;
+    st_init(&symtab, ctx);
+    ir_init(&ir);
+
+    size_t i = 0;
+    ast_foreach_child(ast, ast->root, stmt)
+    {
+        if ( LOG_ENABLED(DEBUG, LOG_GEN) ) {
+            LOG_DEBUGF(LOG_GEN, "stmt [%zu]", i);
+            ast_print_node(LOG_STREAM, ast, stmt, 0);
+        }
+        ir_push(&ir, IR_MARK, 0, IR_IMM((uint32_t)i), IR_IMM(0));
+        gen_stmt(ast, stmt);
+        i++;
+    }
+    ir_alloc(&ir, GEN_REG_COUNT);
+
+    if ( text ) {
+        emit_lit(e, "# HEAD: \n");
+        emit_lit(e, ".global main\n");
+        emit_lit(e, ".text\n\n");
+        emit_lit(e, "main:\n");
+    }
+    emit_op_r(e, MN_PUSH, REG_RBP);
+    emit_op_rr(e, MN_MOV, REG_RSP, REG_RBP);
+    const size_t frame = (ir.slot_count * 4 + 15) & ~(size_t)15;
+    if ( frame != 0 ) { emit_op_ir(e, MN_SUB, frame, REG_RSP); }
+
+    if ( text ) {
+        emit_lit(e, "\n");
+        emit_lit(e, "# CODE: \n");
     }
+    for ( size_t j = 0; j < ir.count; j++ ) {
+        const Ir_Instr* instr = &ir.instrs[j];
+        switch ( instr->op ) {
+            case IR_MARK:
+                if ( !text ) { break; }
+                emit_lit(e, "    # [");
+                emit_uint(e, instr->a.value);
+                emit_lit(e, "]\n");
+                break;
+            case IR_UNOP: gen_unop(e, instr); break;
+            case IR_BINOP: gen_binop(e, instr); break;
+            case IR_RET:
+                gen_load(e, gen_loc(instr->a), REG_EAX);
+                emit_op_rr(e, MN_MOV, REG_RBP, REG_RSP);
+                emit_op_r(e, MN_POP, REG_RBP);
+                emit_op(e, MN_RET);
+                break;
+        }
+    }
+    st_free(&symtab);
+    ir_free(&ir);
+    mem_free(frames);
+    frames = NULL;
+    frame_cap = 0;
     // fprintf(out, "\n");
     // fprintf(out, "# TAIL: \n");
 
@@ -233,3 +534,77 @@ void code_gen_main(FILE* out, AST_Node* root)
     // fprintf(out, "    movl $0, %%edi\n");
     // fprintf(out, "    call exit\n");
 }
+
+// NOTE: out only sees the flushes of the emitter, see emit.h
+void code_gen_main(FILE* out, Context* ctx, const AST* ast)
+{
+    Emitter emitter;
+    Emitter* e = &emitter;
+    if ( !emit_init(e, out) ) {
+        LOG_ERR("out of memory");
+        exit(EXIT_FAILURE);
+    }
+    gen_main(e, ctx, ast);
+    gen_rodata(e, ast);
+    emit_flush(e);
+    emit_free(e);
+}
+
+// NOTE: same program as code_gen_main, encoded into text and rodata. nothing
+//       refers outside .text yet so there are no relocations.
+static void gen_image(Context* ctx, const AST* ast, Emitter* text,
+    Emitter* rodata, Obj_Image* img)
+{
+    if ( !emit_init_code(text) || !emit_init_code(rodata) ) {
+        LOG_ERR("out of memory");
+        exit(EXIT_FAILURE);
+    }
+    gen_main(text, ctx, ast);
+    gen_rodata_code(rodata, ast);
+    if ( text->failed || rodata->failed ) { exit(EXIT_FAILURE); }
+
+    *img = (Obj_Image) {
+        .text = text->data,
+        .text_len = text->len,
+        .rodata = rodata->data,
+        .rodata_len = rodata->len,
+        .relocs = NULL,
+        .reloc_count = 0,
+    };
+}
+
+// written as an ELF object, no assembler in between
+void code_gen_object(FILE* out, Context* ctx, const AST* ast)
+{
+    Emitter text, rodata;
+    Obj_Image img;
+    gen_image(ctx, ast, &text, &rodata, &img);
+    if ( !obj_write_elf(out, &img) ) { exit(EXIT_FAILURE); }
+    emit_free(&text);
+    emit_free(&rodata);
+}
+
+// written as a static executable, no linker either
+void code_gen_exe(FILE* out, Context* ctx, const AST* ast)
+{
+    Emitter text, rodata;
+    Obj_Image img;
+    gen_image(ctx, ast, &text, &rodata, &img);
+    if ( !obj_write_exe(out, &img) ) { exit(EXIT_FAILURE); }
+    emit_free(&text);
+    emit_free(&rodata);
+}
+
+// run in this process, the value main returns
+int code_gen_run(Context* ctx, const AST* ast)
+{
+    Emitter text, rodata;
+    Obj_Image img;
+    gen_image(ctx, ast, &text, &rodata, &img);
+    int result;
+    const int ok = jit_run(&img, &result);
+    emit_free(&text);
+    emit_free(&rodata);
+    if ( !ok ) { exit(EXIT_FAILURE); }
+    return result;
+}
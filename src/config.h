@@ -7,17 +7,31 @@
 //          - max identifier size
 //          - string size?
 
-#define MAIN_CONTEXT_SIZE (1 << 16)
+#define MAIN_CONTEXT_SIZE  (1 << 16)
+#define CONTEXT_BLOCK_SIZE (1 << 20)
 
 #define FILE_MAX_LINES    (1 << 10)
-#define SCANNER_BUFF_SIZE (1 << 10)
+#define SCANNER_BUFF_SIZE (1 << 16)
 
 #define TOKEN_BUFF_SIZE (1 << 12)
 #define TOKEN_MAX_SIZE  (64)
 
+#define LEXER_MAX_JOBS        (64)
+#define LEXER_MIN_CHUNK_LINES (1 << 12)
+
 #define STRING_POOL_SIZE     (1 << 12)
+#define STRING_POOL_DEDUP    (1)
 #define IDENTIFIER_POOL_SIZE (1 << 10)
+#define SHARED_POOL_SHARDS   (64)
 
 #define AST_BUFF_SIZE (1 << 12)
 
+#define EMIT_BUFF_SIZE (1 << 20)
+#define IR_BUFF_SIZE   (1 << 12)
+// NOTE: part of the cache key, bump it when the tree or the parse changes
+#define AST_CACHE_FORMAT (1)
+#define CARMEN_VERSION   "0.1.0"
+
+#define SESSION_STMT_SIZE (1 << 10)
+
 #endif // !_CONFIG_H
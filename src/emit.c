@@ -0,0 +1,507 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "emit.h"
+#include "utils.h"
+
+static const Emit_Text reg_reps[REG__COUNT] = {
+    [REG_EAX] = EMIT_TEXT("%eax"),
+    [REG_ECX] = EMIT_TEXT("%ecx"),
+    [REG_EDX] = EMIT_TEXT("%edx"),
+    [REG_ESI] = EMIT_TEXT("%esi"),
+    [REG_EDI] = EMIT_TEXT("%edi"),
+    [REG_R8D] = EMIT_TEXT("%r8d"),
+    [REG_R9D] = EMIT_TEXT("%r9d"),
+    [REG_R10D] = EMIT_TEXT("%r10d"),
+    [REG_R11D] = EMIT_TEXT("%r11d"),
+    [REG_AL] = EMIT_TEXT("%al"),
+    [REG_CL] = EMIT_TEXT("%cl"),
+    [REG_RAX] = EMIT_TEXT("%rax"),
+    [REG_RCX] = EMIT_TEXT("%rcx"),
+    [REG_RDX] = EMIT_TEXT("%rdx"),
+    [REG_RSP] = EMIT_TEXT("%rsp"),
+    [REG_RBP] = EMIT_TEXT("%rbp"),
+};
+// NOTE: with the indent and the space before the operands
+static const Emit_Text mnemonic_reps[MN__COUNT] = {
+    [MN_MOV] = EMIT_TEXT("    mov "),
+    [MN_MOVL] = EMIT_TEXT("    movl "),
+    [MN_PUSH] = EMIT_TEXT("    push "),
+    [MN_POP] = EMIT_TEXT("    pop "),
+    [MN_SUB] = EMIT_TEXT("    sub "),
+    [MN_RET] = EMIT_TEXT("    ret"),
+    [MN_ADDL] = EMIT_TEXT("    addl "),
+    [MN_SUBL] = EMIT_TEXT("    subl "),
+    [MN_ANDL] = EMIT_TEXT("    andl "),
+    [MN_ORL] = EMIT_TEXT("    orl "),
+    [MN_XORL] = EMIT_TEXT("    xorl "),
+    [MN_CMPL] = EMIT_TEXT("    cmpl "),
+    [MN_TESTL] = EMIT_TEXT("    testl "),
+    [MN_IMULL] = EMIT_TEXT("    imull "),
+    [MN_IDIVL] = EMIT_TEXT("    idivl "),
+    [MN_NEGL] = EMIT_TEXT("    negl "),
+    [MN_NOTL] = EMIT_TEXT("    notl "),
+    [MN_SALL] = EMIT_TEXT("    sall "),
+    [MN_SARL] = EMIT_TEXT("    sarl "),
+    [MN_CLTD] = EMIT_TEXT("    cltd"),
+    [MN_SETL] = EMIT_TEXT("    setl "),
+    [MN_SETG] = EMIT_TEXT("    setg "),
+    [MN_SETLE] = EMIT_TEXT("    setle "),
+    [MN_SETGE] = EMIT_TEXT("    setge "),
+    [MN_SETE] = EMIT_TEXT("    sete "),
+    [MN_SETNE] = EMIT_TEXT("    setne "),
+    [MN_MOVZBL] = EMIT_TEXT("    movzbl "),
+};
+// NOTE: the number in the ModRM/opcode fields (8.. need a REX bit), and if
+//       it needs REX.W
+static const uint8_t reg_codes[REG__COUNT] = {
+    [REG_EAX] = 0,
+    [REG_ECX] = 1,
+    [REG_EDX] = 2,
+    [REG_ESI] = 6,
+    [REG_EDI] = 7,
+    [REG_R8D] = 8,
+    [REG_R9D] = 9,
+    [REG_R10D] = 10,
+    [REG_R11D] = 11,
+    [REG_AL] = 0,
+    [REG_CL] = 1,
+    [REG_RAX] = 0,
+    [REG_RCX] = 1,
+    [REG_RDX] = 2,
+    [REG_RSP] = 4,
+    [REG_RBP] = 5,
+};
+#define REG_WIDE(reg) (REG_RAX <= (reg) && (reg) <= REG_RBP)
+#define REX_W         (0x48)
+
+// NOTE: how a mnemonic is encoded, op is the opcode (0x0Fxx: two bytes) or
+//       the base of the ALU group, digit the ModRM.reg of the /digit forms
+typedef enum {
+    ENC_NONE,
+    ENC_FIXED, // op alone
+    ENC_MOV,
+    ENC_ALU, // add, or, and, sub, xor, cmp
+    ENC_TEST,
+    ENC_IMUL,
+    ENC_GROUP3, // F7 /digit
+    ENC_SHIFT, // D3 /digit by %cl, C1 or D1 /digit by an immediate
+    ENC_SETCC,
+    ENC_MOVZB,
+    ENC_STACK, // push, pop
+} enc_t;
+typedef struct Encoding_s {
+    uint8_t enc;
+    uint8_t digit;
+    uint16_t op;
+} Encoding;
+static const Encoding encodings[MN__COUNT] = {
+    [MN_MOV] = { ENC_MOV, 0, 0 },
+    [MN_MOVL] = { ENC_MOV, 0, 0 },
+    [MN_PUSH] = { ENC_STACK, 0, 0x50 },
+    [MN_POP] = { ENC_STACK, 0, 0x58 },
+    [MN_SUB] = { ENC_ALU, 5, 0x28 },
+    [MN_RET] = { ENC_FIXED, 0, 0xC3 },
+    [MN_ADDL] = { ENC_ALU, 0, 0x00 },
+    [MN_SUBL] = { ENC_ALU, 5, 0x28 },
+    [MN_ANDL] = { ENC_ALU, 4, 0x20 },
+    [MN_ORL] = { ENC_ALU, 1, 0x08 },
+    [MN_XORL] = { ENC_ALU, 6, 0x30 },
+    [MN_CMPL] = { ENC_ALU, 7, 0x38 },
+    [MN_TESTL] = { ENC_TEST, 0, 0x85 },
+    [MN_IMULL] = { ENC_IMUL, 0, 0x0FAF },
+    [MN_IDIVL] = { ENC_GROUP3, 7, 0xF7 },
+    [MN_NEGL] = { ENC_GROUP3, 3, 0xF7 },
+    [MN_NOTL] = { ENC_GROUP3, 2, 0xF7 },
+    [MN_SALL] = { ENC_SHIFT, 4, 0xD3 },
+    [MN_SARL] = { ENC_SHIFT, 7, 0xD3 },
+    [MN_CLTD] = { ENC_FIXED, 0, 0x99 },
+    [MN_SETL] = { ENC_SETCC, 0, 0x0F9C },
+    [MN_SETG] = { ENC_SETCC, 0, 0x0F9F },
+    [MN_SETLE] = { ENC_SETCC, 0, 0x0F9E },
+    [MN_SETGE] = { ENC_SETCC, 0, 0x0F9D },
+    [MN_SETE] = { ENC_SETCC, 0, 0x0F94 },
+    [MN_SETNE] = { ENC_SETCC, 0, 0x0F95 },
+    [MN_MOVZBL] = { ENC_MOVZB, 0, 0x0FB6 },
+};
+// "00" .. "99", two digits per division
+static const char digit_pairs[200] = "00010203040506070809"
+                                     "10111213141516171819"
+                                     "20212223242526272829"
+                                     "30313233343536373839"
+                                     "40414243444546474849"
+                                     "50515253545556575859"
+                                     "60616263646566676869"
+                                     "70717273747576777879"
+                                     "80818283848586878889"
+                                     "90919293949596979899";
+
+int emit_init(Emitter* e, FILE* out)
+{
+    { // sanity check
+        ASSERT(e != NULL);
+        ASSERT(out != NULL);
+    }
+
+    *e = (Emitter) {
+        .out = out,
+        .fd = fileno(out),
+        .cap = EMIT_BUFF_SIZE,
+    };
+    e->data = mem_alloc(MEM_GEN, e->cap);
+    if ( e->data == NULL ) { return false; }
+    // NOTE: whatever the caller printed goes first
+    if ( e->fd != -1 ) { fflush(out); }
+    return true;
+}
+int emit_init_code(Emitter* e)
+{
+    { // sanity check
+        ASSERT(e != NULL);
+    }
+
+    *e = (Emitter) {
+        .mode = EMIT_CODE,
+        .out = NULL,
+        .fd = -1,
+        .cap = EMIT_BUFF_SIZE,
+    };
+    e->data = mem_alloc(MEM_GEN, e->cap);
+    return e->data != NULL;
+}
+void emit_free(Emitter* e)
+{
+    mem_free(e->data);
+    e->data = NULL;
+    e->len = e->cap = 0;
+}
+
+static int emit_out(Emitter* e, const char* str, size_t len)
+{
+    if ( e->fd == -1 ) { return fwrite(str, 1, len, e->out) == len; }
+
+    while ( len != 0 ) {
+        const ssize_t n = write(e->fd, str, len);
+        if ( n == -1 ) {
+            if ( errno == EINTR ) { continue; }
+            return false;
+        }
+        str += n;
+        len -= n;
+    }
+    return true;
+}
+// NOTE: after a failed write the rest of the output is dropped
+int emit_flush(Emitter* e)
+{
+    if ( e->mode == EMIT_CODE ) { return !e->failed; } // NOTE: nowhere to go
+    if ( e->len != 0 && !e->failed && !emit_out(e, e->data, e->len) ) {
+        perror("write");
+        e->failed = true;
+    }
+    e->len = 0;
+    return !e->failed;
+}
+// code mode keeps it all, the buffer doubles
+static void emit_grow(Emitter* e, const char* str, size_t len)
+{
+    if ( e->failed ) { return; }
+    size_t cap = e->cap * 2;
+    while ( cap - e->len < len ) { cap *= 2; }
+    char* data = mem_realloc(MEM_GEN, e->data, cap);
+    if ( data == NULL ) {
+        LOG_ERR("out of memory");
+        e->failed = true;
+        return;
+    }
+    memcpy(&data[e->len], str, len);
+    e->data = data;
+    e->cap = cap;
+    e->len += len;
+}
+// slow path of emit_str, bigger than the room left
+void emit_write(Emitter* e, const char* str, size_t len)
+{
+    if ( e->mode == EMIT_CODE ) {
+        emit_grow(e, str, len);
+        return;
+    }
+    emit_flush(e);
+    if ( len < e->cap ) {
+        memcpy(e->data, str, len);
+        e->len = len;
+    } else if ( !e->failed && !emit_out(e, str, len) ) {
+        perror("write");
+        e->failed = true;
+    }
+}
+
+void emit_uint(Emitter* e, uint64_t value)
+{
+    char buff[20];
+    char* p = &buff[sizeof(buff)];
+    while ( 100 <= value ) {
+        p -= 2;
+        memcpy(p, &digit_pairs[(value % 100) * 2], 2);
+        value /= 100;
+    }
+    if ( 10 <= value ) {
+        p -= 2;
+        memcpy(p, &digit_pairs[value * 2], 2);
+    } else {
+        *--p = (char)('0' + value);
+    }
+    emit_str(e, p, &buff[sizeof(buff)] - p);
+}
+void emit_reg(Emitter* e, reg_t reg)
+{
+    emit_text(e, reg_reps[reg]);
+}
+// disp(base), the disp is left out when 0
+void emit_mem(Emitter* e, int32_t disp, reg_t base)
+{
+    if ( disp < 0 ) {
+        emit_char(e, '-');
+        emit_uint(e, -(int64_t)disp);
+    } else if ( disp != 0 ) {
+        emit_uint(e, disp);
+    }
+    emit_char(e, '(');
+    emit_reg(e, base);
+    emit_char(e, ')');
+}
+
+/*****************************************************************************/
+/* [E]ncoding ****************************************************************/
+/*****************************************************************************/
+
+static inline uint8_t modrm(uint8_t mod, uint8_t reg, uint8_t rm)
+{
+    return (uint8_t)(mod << 6 | (reg & 7) << 3 | (rm & 7));
+}
+static void code_imm32(Emitter* e, uint32_t imm)
+{
+    const char bytes[4] = { (char)imm, (char)(imm >> 8), (char)(imm >> 16),
+        (char)(imm >> 24) };
+    emit_str(e, bytes, 4);
+}
+static inline int fits_imm8(uint64_t imm)
+{
+    const int32_t value = (int32_t)imm;
+    return -128 <= value && value <= 127;
+}
+// REX (if any) and the opcode, reg and rm are the raw register numbers
+static void code_opcode(Emitter* e, uint16_t op, int wide, uint8_t reg,
+    uint8_t rm)
+{
+    const uint8_t rex = (uint8_t)((wide ? 8 : 0) | (reg >> 3) << 2 | rm >> 3);
+    if ( rex != 0 ) { emit_char(e, (char)(0x40 | rex)); }
+    if ( 0xFF < op ) { emit_char(e, (char)(op >> 8)); }
+    emit_char(e, (char)op);
+}
+// opcode with a ModRM on two registers, reg can be a /digit
+static void code_reg(Emitter* e, uint16_t op, int wide, uint8_t reg,
+    reg_t rm)
+{
+    code_opcode(e, op, wide, reg, reg_codes[rm]);
+    emit_char(e, (char)modrm(3, reg, reg_codes[rm]));
+}
+// opcode with a ModRM that picks reg and disp(base), the shortest disp
+static void code_mem(Emitter* e, uint16_t op, int wide, uint8_t reg,
+    int32_t disp, reg_t base)
+{
+    const uint8_t mod = (disp == 0 && base != REG_RBP) ? 0
+        : (-128 <= disp && disp <= 127)                ? 1
+                                                       : 2;
+    code_opcode(e, op, wide, reg, reg_codes[base]);
+    emit_char(e, (char)modrm(mod, reg, reg_codes[base]));
+    if ( base == REG_RSP ) { emit_char(e, 0x24); } // SIB, no index
+    if ( mod == 1 ) {
+        emit_char(e, (char)disp);
+    } else if ( mod == 2 ) {
+        code_imm32(e, (uint32_t)disp);
+    }
+}
+
+// NOTE: only the forms codegen uses are encoded, the rest is a bug there
+static void code_unknown(const char* form, mnemonic_t op)
+{
+    LOG_ERRF("can't encode %s form of mnemonic %d", form, op);
+    exit(EXIT_FAILURE);
+}
+
+void emit_op(Emitter* e, mnemonic_t op)
+{
+    if ( e->mode == EMIT_CODE ) {
+        if ( encodings[op].enc != ENC_FIXED ) { code_unknown("bare", op); }
+        emit_char(e, (char)encodings[op].op);
+        return;
+    }
+    emit_text(e, mnemonic_reps[op]);
+    emit_char(e, '\n');
+}
+void emit_op_r(Emitter* e, mnemonic_t op, reg_t reg)
+{
+    if ( e->mode == EMIT_CODE ) {
+        const Encoding enc = encodings[op];
+        if ( enc.enc == ENC_STACK && REG_WIDE(reg) ) {
+            code_opcode(e, (uint16_t)(enc.op + (reg_codes[reg] & 7)), 0, 0,
+                reg_codes[reg]);
+        } else if ( enc.enc == ENC_GROUP3 ) {
+            code_reg(e, enc.op, REG_WIDE(reg), enc.digit, reg);
+        } else if ( enc.enc == ENC_SETCC && reg == REG_AL ) {
+            code_reg(e, enc.op, 0, 0, reg);
+        } else {
+            code_unknown("reg", op);
+        }
+        return;
+    }
+    emit_text(e, mnemonic_reps[op]);
+    emit_reg(e, reg);
+    emit_char(e, '\n');
+}
+void emit_op_m(Emitter* e, mnemonic_t op, int32_t disp, reg_t base)
+{
+    if ( e->mode == EMIT_CODE ) {
+        const Encoding enc = encodings[op];
+        if ( enc.enc != ENC_GROUP3 ) { code_unknown("mem", op); }
+        code_mem(e, enc.op, 0, enc.digit, disp, base);
+        return;
+    }
+    emit_text(e, mnemonic_reps[op]);
+    emit_mem(e, disp, base);
+    emit_char(e, '\n');
+}
+void emit_op_rr(Emitter* e, mnemonic_t op, reg_t src, reg_t dst)
+{
+    if ( e->mode == EMIT_CODE ) {
+        const Encoding enc = encodings[op];
+        const int wide = REG_WIDE(dst);
+        switch ( enc.enc ) {
+            case ENC_MOV: code_reg(e, 0x89, wide, reg_codes[src], dst); break;
+            case ENC_ALU:
+                code_reg(e, enc.op + 1, wide, reg_codes[src], dst);
+                break;
+            case ENC_TEST:
+                code_reg(e, enc.op, wide, reg_codes[src], dst);
+                break;
+            case ENC_IMUL:
+                code_reg(e, enc.op, wide, reg_codes[dst], src);
+                break;
+            case ENC_SHIFT:
+                if ( src != REG_CL ) { code_unknown("reg, reg", op); }
+                code_reg(e, enc.op, wide, enc.digit, dst);
+                break;
+            case ENC_MOVZB:
+                if ( src != REG_AL ) { code_unknown("reg, reg", op); }
+                code_reg(e, enc.op, 0, reg_codes[dst], src);
+                break;
+            default: code_unknown("reg, reg", op);
+        }
+        return;
+    }
+    emit_text(e, mnemonic_reps[op]);
+    emit_reg(e, src);
+    emit_lit(e, ", ");
+    emit_reg(e, dst);
+    emit_char(e, '\n');
+}
+// NOTE: the immediate is cut to the operand size, imm8 forms when it fits
+//       like gas does (and the short %eax forms of the ALU group)
+void emit_op_ir(Emitter* e, mnemonic_t op, uint64_t imm, reg_t dst)
+{
+    if ( !REG_WIDE(dst) ) { imm = (uint32_t)imm; }
+    if ( e->mode == EMIT_CODE ) {
+        const Encoding enc = encodings[op];
+        const int wide = REG_WIDE(dst);
+        const int imm8 = fits_imm8(imm);
+        if ( enc.enc == ENC_MOV && !wide ) {
+            code_opcode(e, (uint16_t)(0xB8 + (reg_codes[dst] & 7)), 0, 0,
+                reg_codes[dst]);
+            code_imm32(e, (uint32_t)imm);
+            return;
+        }
+        switch ( enc.enc ) {
+            case ENC_ALU:
+                if ( imm8 ) {
+                    code_reg(e, 0x83, wide, enc.digit, dst);
+                } else if ( reg_codes[dst] == 0 ) {
+                    code_opcode(e, enc.op + 5, wide, 0, 0);
+                } else {
+                    code_reg(e, 0x81, wide, enc.digit, dst);
+                }
+                break;
+            case ENC_IMUL:
+                code_reg(e, imm8 ? 0x6B : 0x69, wide, reg_codes[dst], dst);
+                break;
+            case ENC_SHIFT:
+                code_reg(e, (imm == 1) ? 0xD1 : 0xC1, wide, enc.digit, dst);
+                if ( imm != 1 ) { emit_char(e, (char)imm); }
+                return;
+            default: code_unknown("imm, reg", op);
+        }
+        if ( imm8 ) {
+            emit_char(e, (char)imm);
+        } else {
+            code_imm32(e, (uint32_t)imm);
+        }
+        return;
+    }
+    emit_text(e, mnemonic_reps[op]);
+    emit_char(e, '$');
+    emit_uint(e, imm);
+    emit_lit(e, ", ");
+    emit_reg(e, dst);
+    emit_char(e, '\n');
+}
+void emit_op_mr(Emitter* e, mnemonic_t op, int32_t disp, reg_t base, reg_t dst)
+{
+    if ( e->mode == EMIT_CODE ) {
+        const Encoding enc = encodings[op];
+        const int wide = REG_WIDE(dst);
+        switch ( enc.enc ) {
+            case ENC_MOV:
+                code_mem(e, 0x8B, wide, reg_codes[dst], disp, base);
+                break;
+            case ENC_ALU:
+                code_mem(e, enc.op + 3, wide, reg_codes[dst], disp, base);
+                break;
+            case ENC_IMUL:
+                code_mem(e, enc.op, wide, reg_codes[dst], disp, base);
+                break;
+            default: code_unknown("mem, reg", op);
+        }
+        return;
+    }
+    emit_text(e, mnemonic_reps[op]);
+    emit_mem(e, disp, base);
+    emit_lit(e, ", ");
+    emit_reg(e, dst);
+    emit_char(e, '\n');
+}
+void emit_op_rm(Emitter* e, mnemonic_t op, reg_t src, int32_t disp, reg_t base)
+{
+    if ( e->mode == EMIT_CODE ) {
+        const Encoding enc = encodings[op];
+        const int wide = REG_WIDE(src);
+        switch ( enc.enc ) {
+            case ENC_MOV:
+                code_mem(e, 0x89, wide, reg_codes[src], disp, base);
+                break;
+            case ENC_ALU:
+                code_mem(e, enc.op + 1, wide, reg_codes[src], disp, base);
+                break;
+            default: code_unknown("reg, mem", op);
+        }
+        return;
+    }
+    emit_text(e, mnemonic_reps[op]);
+    emit_reg(e, src);
+    emit_lit(e, ", ");
+    emit_mem(e, disp, base);
+    emit_char(e, '\n');
+}
@@ -0,0 +1,135 @@
+#ifndef _EMIT_H
+#define _EMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "utils.h"
+
+// NOTE: the assembly text is appended to one EMIT_BUFF_SIZE buffer that goes
+//       out with a single write() each time it fills up and at the end, the
+//       appends never parse a format nor take the stdio lock. it wraps any
+//       FILE*, the ones without a descriptor (open_memstream) get fwrite.
+//       in EMIT_CODE mode the same calls encode machine code instead, the
+//       buffer then grows and holds the whole section until it's taken.
+typedef enum {
+    EMIT_ASM,
+    EMIT_CODE,
+} emit_mode_t;
+
+typedef struct Emitter_s {
+    emit_mode_t mode;
+    FILE* out;
+    int fd; // -1: fwrite to out
+    int failed;
+    size_t len;
+    size_t cap;
+    char* data;
+} Emitter;
+
+// NOTE: a constant piece of text with its length, see EMIT_TEXT
+typedef struct Emit_Text_s {
+    const char* str;
+    size_t len;
+} Emit_Text;
+#define EMIT_TEXT(lit) { (lit), sizeof(lit) - 1 }
+
+typedef enum {
+    REG_EAX,
+    REG_ECX,
+    REG_EDX,
+    REG_ESI,
+    REG_EDI,
+    REG_R8D,
+    REG_R9D,
+    REG_R10D,
+    REG_R11D,
+    REG_AL,
+    REG_CL,
+    REG_RAX,
+    REG_RCX,
+    REG_RDX,
+    REG_RSP,
+    REG_RBP,
+    REG__COUNT,
+} reg_t;
+
+// NOTE: the l ones are 32 bit, the rest takes its size from the registers
+typedef enum {
+    MN_MOV,
+    MN_MOVL,
+    MN_PUSH,
+    MN_POP,
+    MN_SUB,
+    MN_RET,
+    MN_ADDL,
+    MN_SUBL,
+    MN_ANDL,
+    MN_ORL,
+    MN_XORL,
+    MN_CMPL,
+    MN_TESTL,
+    MN_IMULL,
+    MN_IDIVL,
+    MN_NEGL,
+    MN_NOTL,
+    MN_SALL, // by %cl or an immediate
+    MN_SARL,
+    MN_CLTD,
+    MN_SETL, // into %al
+    MN_SETG,
+    MN_SETLE,
+    MN_SETGE,
+    MN_SETE,
+    MN_SETNE,
+    MN_MOVZBL, // from %al
+    MN__COUNT,
+} mnemonic_t;
+
+extern int emit_init(Emitter* e, FILE* out);
+extern int emit_init_code(Emitter* e);
+extern int emit_flush(Emitter* e);
+extern void emit_free(Emitter* e);
+extern void emit_write(Emitter* e, const char* str, size_t len);
+
+extern void emit_uint(Emitter* e, uint64_t value);
+extern void emit_reg(Emitter* e, reg_t reg);
+extern void emit_mem(Emitter* e, int32_t disp, reg_t base);
+// whole instructions, AT&T operand order, as text or encoded by mode
+extern void emit_op(Emitter* e, mnemonic_t op);
+extern void emit_op_r(Emitter* e, mnemonic_t op, reg_t reg);
+extern void emit_op_m(Emitter* e, mnemonic_t op, int32_t disp, reg_t base);
+extern void emit_op_rr(Emitter* e, mnemonic_t op, reg_t src, reg_t dst);
+extern void emit_op_ir(Emitter* e, mnemonic_t op, uint64_t imm, reg_t dst);
+extern void emit_op_mr(
+    Emitter* e, mnemonic_t op, int32_t disp, reg_t base, reg_t dst);
+extern void emit_op_rm(
+    Emitter* e, mnemonic_t op, reg_t src, int32_t disp, reg_t base);
+
+static inline void emit_str(Emitter* e, const char* str, size_t len)
+{
+    if ( e->cap - e->len < len ) {
+        emit_write(e, str, len);
+        return;
+    }
+    memcpy(&e->data[e->len], str, len);
+    e->len += len;
+}
+#define emit_lit(e, lit) emit_str((e), (lit), sizeof(lit) - 1)
+static inline void emit_text(Emitter* e, Emit_Text text)
+{
+    emit_str(e, text.str, text.len);
+}
+static inline void emit_char(Emitter* e, char c)
+{
+    if ( e->len == e->cap ) {
+        emit_write(e, &c, 1);
+        return;
+    }
+    e->data[e->len++] = c;
+}
+
+#endif // !_EMIT_H
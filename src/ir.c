@@ -0,0 +1,197 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "ir.h"
+#include "utils.h"
+
+static void* ir_grow(void* data, size_t* cap, size_t count, size_t size)
+{
+    if ( count < *cap ) { return data; }
+
+    const size_t new_cap = (*cap == 0) ? IR_BUFF_SIZE : *cap * 2;
+    void* ptr = mem_realloc(MEM_GEN, data, size * new_cap);
+    if ( ptr == NULL ) {
+        LOG_ERR("out of memory");
+        exit(EXIT_FAILURE);
+    }
+    *cap = new_cap;
+    return ptr;
+}
+
+void ir_init(Ir* ir)
+{
+    *ir = (Ir) { 0 };
+}
+void ir_free(Ir* ir)
+{
+    mem_free(ir->instrs);
+    mem_free(ir->vregs);
+    mem_free(ir->locs);
+    *ir = (Ir) { 0 };
+}
+
+Ir_Value ir_push(Ir* ir, ir_op_t op, uint8_t tag, Ir_Value a, Ir_Value b)
+{
+    const uint32_t at = (uint32_t)ir->count;
+    if ( IR_IS_VREG(a) ) { ir->vregs[a.value].end = at; }
+    if ( IR_IS_VREG(b) ) { ir->vregs[b.value].end = at; }
+
+    Ir_Value dst = { .kind = IR_VAL_NONE };
+    if ( op == IR_UNOP || op == IR_BINOP ) {
+        ir->vregs = ir_grow(
+            ir->vregs, &ir->vreg_cap, ir->vreg_count, sizeof(Ir_Interval));
+        ir->vregs[ir->vreg_count] = (Ir_Interval) { .start = at, .end = at };
+        dst = (Ir_Value) { .kind = IR_VAL_VREG,
+            .value = (uint32_t)ir->vreg_count++ };
+    }
+    ir->instrs = ir_grow(ir->instrs, &ir->cap, ir->count, sizeof(Ir_Instr));
+    ir->instrs[ir->count++] = (Ir_Instr) {
+        .op = (uint8_t)op,
+        .tag = tag,
+        .dst = dst.value,
+        .a = a,
+        .b = b,
+    };
+    return dst;
+}
+
+/*****************************************************************************/
+/* [R]egister allocation *****************************************************/
+/*****************************************************************************/
+
+// a slot of a dead vreg, free from instruction at on
+typedef struct Free_Slot_s {
+    int32_t slot;
+    uint32_t at;
+} Free_Slot;
+
+// NOTE: the spilled vregs still alive, a min-heap by end so their slots can
+//       be taken again once they're done
+typedef struct Slot_Heap_s {
+    uint32_t* vregs;
+    size_t count;
+    size_t cap;
+    Free_Slot* free;
+    size_t free_count;
+    size_t free_cap;
+} Slot_Heap;
+
+static void heap_push(Slot_Heap* h, const Ir_Interval* vregs, uint32_t v)
+{
+    h->vregs = ir_grow(h->vregs, &h->cap, h->count, sizeof(uint32_t));
+    size_t i = h->count++;
+    while ( 0 < i && vregs[v].end < vregs[h->vregs[(i - 1) / 2]].end ) {
+        h->vregs[i] = h->vregs[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    h->vregs[i] = v;
+}
+static void heap_pop(Slot_Heap* h, const Ir_Interval* vregs)
+{
+    const uint32_t last = h->vregs[--h->count];
+    size_t i = 0;
+    while ( true ) {
+        size_t child = i * 2 + 1;
+        if ( h->count <= child ) { break; }
+        if ( child + 1 < h->count
+            && vregs[h->vregs[child + 1]].end < vregs[h->vregs[child]].end ) {
+            child++;
+        }
+        if ( vregs[last].end <= vregs[h->vregs[child]].end ) { break; }
+        h->vregs[i] = h->vregs[child];
+        i = child;
+    }
+    h->vregs[i] = last;
+}
+
+// NOTE: v may be an older vreg pushed out of its register, it can only take
+//       a slot that was already free when v was defined
+static void ir_spill(Ir* ir, Slot_Heap* h, uint32_t v)
+{
+    int32_t slot = -1;
+    for ( size_t i = h->free_count; 0 < i; i-- ) {
+        if ( ir->vregs[v].start < h->free[i - 1].at ) { continue; }
+        slot = h->free[i - 1].slot;
+        h->free[i - 1] = h->free[--h->free_count];
+        break;
+    }
+    if ( slot < 0 ) { slot = (int32_t)ir->slot_count++; }
+    ir->locs[v] = -slot - 1;
+    heap_push(h, ir->vregs, v);
+}
+
+// NOTE: Poletto and Sarkar's linear scan. the vregs come sorted by start
+//       (one per instruction, in order), active holds the ones in registers
+//       sorted by end. a vreg whose last use is the instruction that defines
+//       v is done by then, v may take its register. when none is left the
+//       one that lives the longest goes to the stack.
+void ir_alloc(Ir* ir, size_t reg_count)
+{
+    { // sanity check
+        ASSERT(ir != NULL);
+        ASSERT(0 < reg_count && reg_count <= IR_MAX_REGS);
+    }
+
+    mem_free(ir->locs);
+    ir->locs = mem_alloc(MEM_GEN, sizeof(int32_t) * (ir->vreg_count + 1));
+    if ( ir->locs == NULL ) {
+        LOG_ERR("out of memory");
+        exit(EXIT_FAILURE);
+    }
+    ir->slot_count = 0;
+
+    const Ir_Interval* vregs = ir->vregs;
+    uint32_t active[IR_MAX_REGS];
+    size_t active_count = 0;
+    uint32_t free_regs = (reg_count == 32) ? ~0u : (1u << reg_count) - 1;
+    Slot_Heap heap = { 0 };
+
+    for ( uint32_t v = 0; v < ir->vreg_count; v++ ) {
+        const uint32_t start = vregs[v].start;
+        size_t done = 0;
+        while ( done < active_count && vregs[active[done]].end <= start ) {
+            free_regs |= 1u << ir->locs[active[done]];
+            done++;
+        }
+        active_count -= done;
+        memmove(active, &active[done], sizeof(uint32_t) * active_count);
+        while ( heap.count != 0 && vregs[heap.vregs[0]].end <= start ) {
+            heap.free = ir_grow(
+                heap.free, &heap.free_cap, heap.free_count, sizeof(Free_Slot));
+            heap.free[heap.free_count++] = (Free_Slot) {
+                .slot = IR_SLOT(ir->locs[heap.vregs[0]]),
+                .at = vregs[heap.vregs[0]].end,
+            };
+            heap_pop(&heap, vregs);
+        }
+
+        if ( free_regs == 0 ) {
+            const uint32_t last = active[active_count - 1];
+            if ( vregs[last].end <= vregs[v].end ) {
+                ir_spill(ir, &heap, v);
+                continue;
+            }
+            free_regs |= 1u << ir->locs[last];
+            active_count--;
+            ir_spill(ir, &heap, last);
+        }
+        int32_t reg = 0;
+        while ( !(free_regs & (1u << reg)) ) { reg++; }
+        free_regs &= ~(1u << reg);
+        ir->locs[v] = reg;
+
+        size_t i = active_count++;
+        while ( 0 < i && vregs[v].end < vregs[active[i - 1]].end ) {
+            active[i] = active[i - 1];
+            i--;
+        }
+        active[i] = v;
+    }
+    LOG_DEBUGF(LOG_GEN, "regalloc: %zu vregs, %zu stack slots",
+        ir->vreg_count, ir->slot_count);
+
+    mem_free(heap.vregs);
+    mem_free(heap.free);
+}
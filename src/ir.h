@@ -0,0 +1,68 @@
+#ifndef _IR_H
+#define _IR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// NOTE: the program as a list of instructions on virtual registers, a new
+//       vreg for every value computed. there's no control flow, so a local
+//       is just a name for its current value (an assignment copies nothing)
+//       and a vreg lives from its instruction to its last use. ir_alloc then
+//       gives each vreg a register or a stack slot for all its life.
+typedef enum {
+    IR_VAL_NONE,
+    IR_VAL_IMM, // value is the constant
+    IR_VAL_VREG, // value is the vreg
+} ir_val_t;
+typedef struct Ir_Value_s {
+    uint32_t kind;
+    uint32_t value;
+} Ir_Value;
+
+typedef enum {
+    IR_MARK, // statement a.value starts here, no code
+    IR_UNOP, // dst = tag a
+    IR_BINOP, // dst = a tag b
+    IR_RET, // return a
+} ir_op_t;
+
+typedef struct Ir_Instr_s {
+    uint8_t op;
+    uint8_t tag; // ast_node_t of the operator
+    uint16_t _pad;
+    uint32_t dst;
+    Ir_Value a;
+    Ir_Value b;
+} Ir_Instr;
+
+// instruction that defines the vreg and the last one that reads it
+typedef struct Ir_Interval_s {
+    uint32_t start;
+    uint32_t end;
+} Ir_Interval;
+
+#define IR_MAX_REGS    (32)
+#define IR_SLOT(loc)   (-(loc) - 1) // loc < 0: spilled to that slot
+#define IR_IMM(n)      ((Ir_Value) { .kind = IR_VAL_IMM, .value = (n) })
+#define IR_IS_VREG(v)  ((v).kind == IR_VAL_VREG)
+
+typedef struct Ir_s {
+    Ir_Instr* instrs;
+    size_t count;
+    size_t cap;
+    Ir_Interval* vregs;
+    size_t vreg_count;
+    size_t vreg_cap;
+    int32_t* locs; // by vreg, after ir_alloc: register index or slot
+    size_t slot_count;
+} Ir;
+
+extern void ir_init(Ir* ir);
+extern void ir_free(Ir* ir);
+// appends an instruction, the vreg it defines (if any) is returned
+extern Ir_Value ir_push(Ir* ir, ir_op_t op, uint8_t tag, Ir_Value a,
+    Ir_Value b);
+// linear scan over reg_count registers, the rest goes to stack slots
+extern void ir_alloc(Ir* ir, size_t reg_count);
+
+#endif // !_IR_H
@@ -0,0 +1,53 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "jit.h"
+#include "utils.h"
+
+// NOTE: layout: text, rodata. the rest is int3 so running off the end of
+//       main traps. written while only writable, then only executable, never
+//       both. main is called as is: it keeps the stack aligned and only
+//       uses caller-saved registers (see gen_regs in the codegen).
+int jit_run(const Obj_Image* img, int* result)
+{
+    { // sanity check
+        ASSERT(img != NULL);
+        ASSERT(result != NULL);
+    }
+
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t rodata_off = DATA_ROUND_UP(img->text_len, 16);
+    const size_t size = DATA_ROUND_UP(rodata_off + img->rodata_len, page);
+    char* map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ( map == MAP_FAILED ) {
+        perror("jit: mmap");
+        return false;
+    }
+
+    memset(map, 0xCC, size);
+    memcpy(map, img->text, img->text_len);
+    memcpy(&map[rodata_off], img->rodata, img->rodata_len);
+    for ( size_t i = 0; i < img->reloc_count; i++ ) {
+        if ( !obj_relocate(map, img->text_len, (uintptr_t)map,
+                 (uintptr_t)&map[rodata_off], &img->relocs[i]) ) {
+            munmap(map, size);
+            return false;
+        }
+    }
+    if ( mprotect(map, size, PROT_READ | PROT_EXEC) == -1 ) {
+        perror("jit: mprotect");
+        munmap(map, size);
+        return false;
+    }
+
+    int (*entry)(void) = (int (*)(void))(uintptr_t)map;
+    LOG_INFOF(LOG_GEN, "jit: %zu bytes of code at %p", img->text_len,
+        (void*)map);
+    *result = entry();
+    munmap(map, size);
+    return true;
+}
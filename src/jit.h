@@ -0,0 +1,9 @@
+#ifndef _JIT_H
+#define _JIT_H
+
+#include "object.h"
+
+// maps img, calls its main and puts what it returned in result
+extern int jit_run(const Obj_Image* img, int* result);
+
+#endif // !_JIT_H
@@ -0,0 +1,322 @@
+#include <elf.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "object.h"
+#include "utils.h"
+
+typedef enum {
+    SEC_NULL,
+    SEC_TEXT,
+    SEC_RODATA,
+    SEC_RELA_TEXT,
+    SEC_SYMTAB,
+    SEC_STRTAB,
+    SEC_SHSTRTAB,
+    SEC_NOTE_STACK,
+    SEC__COUNT,
+} obj_sec_t;
+
+static const char* const section_names[SEC__COUNT] = {
+    [SEC_NULL] = "",
+    [SEC_TEXT] = ".text",
+    [SEC_RODATA] = ".rodata",
+    [SEC_RELA_TEXT] = ".rela.text",
+    [SEC_SYMTAB] = ".symtab",
+    [SEC_STRTAB] = ".strtab",
+    [SEC_SHSTRTAB] = ".shstrtab",
+    // NOTE: empty, tells the linker the stack isn't executable
+    [SEC_NOTE_STACK] = ".note.GNU-stack",
+};
+static const char symbol_names[] = "\0main"; // main at 1
+
+// NOTE: every section is always there (maybe empty) so the indices are fixed,
+//       the file is built in memory and written at once like the AST cache.
+//       layout: header, sections in order, section headers.
+int obj_write_elf(FILE* out, const Obj_Image* img)
+{
+    { // sanity check
+        ASSERT(out != NULL);
+        ASSERT(img != NULL);
+    }
+
+    size_t shstr_len = 0;
+    for ( size_t i = 0; i < SEC__COUNT; i++ ) {
+        shstr_len += strlen(section_names[i]) + 1;
+    }
+
+    Elf64_Shdr sh[SEC__COUNT] = { 0 };
+    size_t size = sizeof(Elf64_Ehdr);
+    size = DATA_ROUND_UP(size, 16);
+    sh[SEC_TEXT] = (Elf64_Shdr) {
+        .sh_type = SHT_PROGBITS,
+        .sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+        .sh_offset = size,
+        .sh_size = img->text_len,
+        .sh_addralign = 16,
+    };
+    size += img->text_len;
+    sh[SEC_RODATA] = (Elf64_Shdr) {
+        .sh_type = SHT_PROGBITS,
+        .sh_flags = SHF_ALLOC,
+        .sh_offset = size,
+        .sh_size = img->rodata_len,
+        .sh_addralign = 1,
+    };
+    size += img->rodata_len;
+    size = DATA_ROUND_UP(size, 8);
+    sh[SEC_RELA_TEXT] = (Elf64_Shdr) {
+        .sh_type = SHT_RELA,
+        .sh_flags = SHF_INFO_LINK,
+        .sh_offset = size,
+        .sh_size = sizeof(Elf64_Rela) * img->reloc_count,
+        .sh_link = SEC_SYMTAB,
+        .sh_info = SEC_TEXT,
+        .sh_addralign = 8,
+        .sh_entsize = sizeof(Elf64_Rela),
+    };
+    size += sizeof(Elf64_Rela) * img->reloc_count;
+    sh[SEC_SYMTAB] = (Elf64_Shdr) {
+        .sh_type = SHT_SYMTAB,
+        .sh_offset = size,
+        .sh_size = sizeof(Elf64_Sym) * OBJ_SYM__COUNT,
+        .sh_link = SEC_STRTAB,
+        .sh_info = OBJ_SYM_MAIN, // first global
+        .sh_addralign = 8,
+        .sh_entsize = sizeof(Elf64_Sym),
+    };
+    size += sizeof(Elf64_Sym) * OBJ_SYM__COUNT;
+    sh[SEC_STRTAB] = (Elf64_Shdr) {
+        .sh_type = SHT_STRTAB,
+        .sh_offset = size,
+        .sh_size = sizeof(symbol_names),
+        .sh_addralign = 1,
+    };
+    size += sizeof(symbol_names);
+    sh[SEC_SHSTRTAB] = (Elf64_Shdr) {
+        .sh_type = SHT_STRTAB,
+        .sh_offset = size,
+        .sh_size = shstr_len,
+        .sh_addralign = 1,
+    };
+    size += shstr_len;
+    sh[SEC_NOTE_STACK] = (Elf64_Shdr) {
+        .sh_type = SHT_PROGBITS,
+        .sh_offset = size,
+        .sh_addralign = 1,
+    };
+    size = DATA_ROUND_UP(size, 8);
+    const size_t sh_off = size;
+    size += sizeof(sh);
+
+    char* buff = mem_calloc(MEM_GEN, 1, size);
+    if ( buff == NULL ) {
+        LOG_ERR("out of memory");
+        return false;
+    }
+    { // fill
+        const Elf64_Ehdr eh = {
+            .e_ident = { ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3, ELFCLASS64,
+                ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV },
+            .e_type = ET_REL,
+            .e_machine = EM_X86_64,
+            .e_version = EV_CURRENT,
+            .e_shoff = sh_off,
+            .e_ehsize = sizeof(Elf64_Ehdr),
+            .e_shentsize = sizeof(Elf64_Shdr),
+            .e_shnum = SEC__COUNT,
+            .e_shstrndx = SEC_SHSTRTAB,
+        };
+        memcpy(buff, &eh, sizeof(eh));
+        memcpy(&buff[sh[SEC_TEXT].sh_offset], img->text, img->text_len);
+        memcpy(&buff[sh[SEC_RODATA].sh_offset], img->rodata, img->rodata_len);
+
+        Elf64_Rela* rela = (Elf64_Rela*)&buff[sh[SEC_RELA_TEXT].sh_offset];
+        for ( size_t i = 0; i < img->reloc_count; i++ ) {
+            const Obj_Reloc* r = &img->relocs[i];
+            rela[i] = (Elf64_Rela) {
+                .r_offset = r->offset,
+                .r_info = ELF64_R_INFO(r->symbol, r->type),
+                .r_addend = r->addend,
+            };
+        }
+
+        const Elf64_Sym syms[OBJ_SYM__COUNT] = {
+            [OBJ_SYM_TEXT] = {
+                .st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION),
+                .st_shndx = SEC_TEXT,
+            },
+            [OBJ_SYM_RODATA] = {
+                .st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION),
+                .st_shndx = SEC_RODATA,
+            },
+            [OBJ_SYM_MAIN] = {
+                .st_name = 1,
+                .st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC),
+                .st_shndx = SEC_TEXT,
+                .st_value = 0,
+                .st_size = img->text_len,
+            },
+        };
+        memcpy(&buff[sh[SEC_SYMTAB].sh_offset], syms, sizeof(syms));
+        memcpy(&buff[sh[SEC_STRTAB].sh_offset], symbol_names,
+            sizeof(symbol_names));
+
+        char* names = &buff[sh[SEC_SHSTRTAB].sh_offset];
+        size_t off = 0;
+        for ( size_t i = 0; i < SEC__COUNT; i++ ) {
+            const size_t len = strlen(section_names[i]) + 1;
+            sh[i].sh_name = (uint32_t)off;
+            memcpy(&names[off], section_names[i], len);
+            off += len;
+        }
+        memcpy(&buff[sh_off], sh, sizeof(sh));
+    }
+
+    const int ok = fwrite(buff, 1, size, out) == size;
+    if ( !ok ) { perror("write"); }
+    mem_free(buff);
+    return ok;
+}
+
+// NOTE: the few relocation types an image of ours can have, S + A (- P)
+int obj_relocate(char* text, size_t text_len, uint64_t text_addr,
+    uint64_t rodata_addr, const Obj_Reloc* r)
+{
+    const uint64_t sym = (r->symbol == OBJ_SYM_RODATA) ? rodata_addr
+                                                        : text_addr;
+    const uint64_t value = sym + (uint64_t)r->addend;
+    char* place = &text[r->offset];
+    switch ( r->type ) {
+        case R_X86_64_PC32:
+        case R_X86_64_PLT32: {
+            if ( text_len < 4 || text_len - 4 < r->offset ) { break; }
+            const int32_t rel = (int32_t)(value - (text_addr + r->offset));
+            memcpy(place, &rel, 4);
+            return true;
+        }
+        case R_X86_64_64: {
+            if ( text_len < 8 || text_len - 8 < r->offset ) { break; }
+            memcpy(place, &value, 8);
+            return true;
+        }
+        default: break;
+    }
+    LOG_ERRF("can't apply relocation type %u at %#lx", r->type,
+        (unsigned long)r->offset);
+    return false;
+}
+
+#define EXE_BASE (0x400000) // like ld -no-pie
+#define EXE_PAGE (0x1000)
+
+// NOTE: _start gets an aligned stack from the kernel, so main gets one
+//       like any callee, and its result goes to the exit syscall
+static const char start_stub[] = "\x31\xed" // xor %ebp, %ebp
+                                 "\xe8\0\0\0\0" // call main
+                                 "\x89\xc7" // mov %eax, %edi
+                                 "\xb8\x3c\0\0\0" // mov $60, %eax (exit)
+                                 "\x0f\x05"; // syscall
+#define START_CALL (3) // offset of the rel32
+
+// NOTE: no sections, just what the kernel loads: a read+exec segment with
+//       the headers, _start and main, a read only one for rodata (if any),
+//       and a non executable stack. the mode is set like a linker would.
+int obj_write_exe(FILE* out, const Obj_Image* img)
+{
+    { // sanity check
+        ASSERT(out != NULL);
+        ASSERT(img != NULL);
+    }
+
+    const size_t phnum = (img->rodata_len != 0) ? 3 : 2;
+    const size_t start_off
+        = DATA_ROUND_UP(sizeof(Elf64_Ehdr) + sizeof(Elf64_Phdr) * 3, 16);
+    const size_t text_off
+        = DATA_ROUND_UP(start_off + sizeof(start_stub) - 1, 16);
+    const size_t text_end = text_off + img->text_len;
+    const size_t rodata_off = DATA_ROUND_UP(text_end, EXE_PAGE);
+    const size_t size = (img->rodata_len != 0) ? rodata_off + img->rodata_len
+                                               : text_end;
+
+    char* buff = mem_calloc(MEM_GEN, 1, size);
+    if ( buff == NULL ) {
+        LOG_ERR("out of memory");
+        return false;
+    }
+    { // fill
+        const Elf64_Ehdr eh = {
+            .e_ident = { ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3, ELFCLASS64,
+                ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV },
+            .e_type = ET_EXEC,
+            .e_machine = EM_X86_64,
+            .e_version = EV_CURRENT,
+            .e_entry = EXE_BASE + start_off,
+            .e_phoff = sizeof(Elf64_Ehdr),
+            .e_ehsize = sizeof(Elf64_Ehdr),
+            .e_phentsize = sizeof(Elf64_Phdr),
+            .e_phnum = (uint16_t)phnum,
+        };
+        const Elf64_Phdr ph[3] = {
+            {
+                .p_type = PT_LOAD,
+                .p_flags = PF_R | PF_X,
+                .p_offset = 0,
+                .p_vaddr = EXE_BASE,
+                .p_paddr = EXE_BASE,
+                .p_filesz = text_end,
+                .p_memsz = text_end,
+                .p_align = EXE_PAGE,
+            },
+            {
+                .p_type = PT_GNU_STACK,
+                .p_flags = PF_R | PF_W,
+                .p_align = 16,
+            },
+            {
+                .p_type = PT_LOAD,
+                .p_flags = PF_R,
+                .p_offset = rodata_off,
+                .p_vaddr = EXE_BASE + rodata_off,
+                .p_paddr = EXE_BASE + rodata_off,
+                .p_filesz = img->rodata_len,
+                .p_memsz = img->rodata_len,
+                .p_align = EXE_PAGE,
+            },
+        };
+        memcpy(buff, &eh, sizeof(eh));
+        memcpy(&buff[sizeof(eh)], ph, sizeof(Elf64_Phdr) * phnum);
+
+        memcpy(&buff[start_off], start_stub, sizeof(start_stub) - 1);
+        const int32_t call
+            = (int32_t)(text_off - (start_off + START_CALL + 4));
+        memcpy(&buff[start_off + START_CALL], &call, 4);
+
+        memcpy(&buff[text_off], img->text, img->text_len);
+        if ( img->rodata_len != 0 ) {
+            memcpy(&buff[rodata_off], img->rodata, img->rodata_len);
+        }
+        for ( size_t i = 0; i < img->reloc_count; i++ ) {
+            if ( !obj_relocate(&buff[text_off], img->text_len,
+                     EXE_BASE + text_off, EXE_BASE + rodata_off,
+                     &img->relocs[i]) ) {
+                mem_free(buff);
+                return false;
+            }
+        }
+    }
+
+    int ok = fwrite(buff, 1, size, out) == size;
+    if ( !ok ) { perror("write"); }
+    mem_free(buff);
+
+    const mode_t mask = umask(0);
+    umask(mask);
+    if ( ok && fchmod(fileno(out), 0777 & ~mask) == -1 ) {
+        perror("chmod");
+        ok = false;
+    }
+    return ok;
+}
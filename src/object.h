@@ -0,0 +1,43 @@
+#ifndef _OBJECT_H
+#define _OBJECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// NOTE: fixed symbol table of the objects, relocations refer to these
+typedef enum {
+    OBJ_SYM_NULL,
+    OBJ_SYM_TEXT, // section symbols, for the addends into them
+    OBJ_SYM_RODATA,
+    OBJ_SYM_MAIN,
+    OBJ_SYM__COUNT,
+} obj_sym_t;
+
+// a place in .text patched by the linker, an R_X86_64_* type
+typedef struct Obj_Reloc_s {
+    uint64_t offset;
+    obj_sym_t symbol;
+    uint32_t type;
+    int64_t addend;
+} Obj_Reloc;
+
+// NOTE: the encoded program, main starts at the beginning of text
+typedef struct Obj_Image_s {
+    const char* text;
+    size_t text_len;
+    const char* rodata;
+    size_t rodata_len;
+    const Obj_Reloc* relocs;
+    size_t reloc_count;
+} Obj_Image;
+
+// writes img as an ELF64 relocatable object (.o) for the system linker
+extern int obj_write_elf(FILE* out, const Obj_Image* img);
+// writes img as a static ELF64 executable, no libc and no linker
+extern int obj_write_exe(FILE* out, const Obj_Image* img);
+// patches r in text, for text and rodata loaded at those addresses
+extern int obj_relocate(char* text, size_t text_len, uint64_t text_addr,
+    uint64_t rodata_addr, const Obj_Reloc* r);
+
+#endif // !_OBJECT_H
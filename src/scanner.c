@@ -1,10 +1,16 @@
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "config.h"
 #include "scanner.h"
+#include "simd.h"
 #include "utils.h"
 
 
@@ -17,6 +23,7 @@ int get_line(Line* line, FILE* stream)
     }
 
     char buff[LINE_BUF_BATCH_SIZE + 1];
+    char* data = NULL;
     size_t n = 0;
     int c = 0;
     line->size = 0;
@@ -29,64 +36,168 @@ int get_line(Line* line, FILE* stream)
 
         if ( n == LINE_BUF_BATCH_SIZE ) { // load batch
             const size_t size = line->size + LINE_BUF_BATCH_SIZE;
-            char* ptr = realloc(line->data, size);
+            char* ptr = mem_realloc(MEM_SCANNER, data, size);
             if ( ptr == NULL ) {
-                free(line->data);
+                mem_free(data);
                 return -1;
             }
             memcpy(&ptr[line->size], buff, LINE_BUF_BATCH_SIZE);
-            line->data = ptr;
+            data = ptr;
             line->size += LINE_BUF_BATCH_SIZE;
             n = 0;
         }
     }
 
-    if ( line->data == NULL && c == EOF ) { return -1; }
+    if ( data == NULL && n == 0 && c == EOF ) { return -1; }
 
     { // load last batch
-        char* ptr = realloc(line->data, line->size + n + 1);
+        char* ptr = mem_realloc(MEM_SCANNER, data, line->size + n + 1);
         if ( !ptr ) {
-            free(line->data);
+            mem_free(data);
             return -1;
         }
 
         memcpy(&ptr[line->size], buff, n);
-        line->data = ptr;
         line->size += n;
         line->len = line->size;
-        line->data[line->len] = '\0';
+        ptr[line->len] = '\0';
+        line->data = ptr;
     }
 
     return 0;
 }
 
+// refills the window with one big read(), leftovers of the previous refill
+// are shifted to the front first. returns the amount of bytes read.
+static size_t scanner_refill(Scanner* const scanner)
+{
+    Buffer* const buff = scanner->buff;
+
+    buff_lshift(buff, scanner->pos);
+    scanner->pos = 0;
+
+    // NOTE: keep one byte for the '\0' sentinel
+    const size_t room = buff->size - 1 - buff->count;
+    if ( scanner->eof || room == 0 ) { return 0; }
+
+    ssize_t n;
+    do {
+        n = read(scanner->fd, &buff->data[buff->count], room);
+    } while ( n == -1 && errno == EINTR );
+
+    if ( n <= 0 ) {
+        if ( n == -1 ) {
+            perror("read");
+            scanner->failed = 1;
+        }
+        scanner->eof = 1;
+        n = 0;
+    }
+    buff->count += n;
+    buff->data[buff->count] = '\0';
+    return n;
+}
+static Line* scanner_stream_peek(Scanner* const scanner)
+{
+    Line* view = &scanner->view;
+    if ( view->data != NULL ) { return view; }
+
+    Buffer* const buff = scanner->buff;
+    size_t scanned = 0; // bytes of the pending line already searched
+    while ( 1 ) {
+        const char* start = &buff->data[scanner->pos];
+        const size_t left = buff->count - scanner->pos;
+
+        const size_t nl = scanned
+            + simd_find_newline(start + scanned, left - scanned);
+        if ( nl < left ) {
+            view->len = nl + 1;
+            break;
+        }
+        scanned = left;
+
+        if ( scanner_refill(scanner) == 0 ) {
+            if ( scanner->failed || left == 0 ) { return NULL; }
+            if ( !scanner->eof ) { // window full, no newline in sight
+                LOG_ERRF("%s: line longer than %d bytes", scanner->file_name,
+                    SCANNER_BUFF_SIZE);
+                scanner->failed = 1;
+                return NULL;
+            }
+            view->len = left; // last line, no trailing newline
+            break;
+        }
+    }
+
+    view->data = &buff->data[scanner->pos];
+    view->size = view->len;
+    return view;
+}
+
 Line* scanner_next(Scanner* const scanner)
 {
+    if ( scanner->mode == SCANNER_MODE_STREAM ) {
+        ASSERT(scanner->view.data != NULL);
+        scanner->pos += scanner->view.len;
+        scanner->view.data = NULL;
+        return scanner_stream_peek(scanner);
+    }
+    if ( scanner->mode == SCANNER_MODE_MMAP ) {
+        ASSERT(scanner->line_index < scanner->line_count);
+        scanner->line_index++;
+        return scanner_peek(scanner);
+    }
     ASSERT(scanner->current != NULL);
     return (Line*)(scanner->current = scanner->current->next);
 }
-Line* scanner_peek(Scanner* const scanner) { return (Line*)(scanner->current); }
+Line* scanner_peek(Scanner* const scanner)
+{
+    if ( scanner->mode == SCANNER_MODE_STREAM ) {
+        return scanner_stream_peek(scanner);
+    }
+    if ( scanner->mode == SCANNER_MODE_MMAP ) {
+        const size_t i = scanner->line_index;
+        if ( scanner->line_count <= i ) { return NULL; }
+
+        Line* view = &scanner->view;
+        view->data = &scanner->src[scanner->offsets[i]];
+        view->len = scanner->offsets[i + 1] - scanner->offsets[i];
+        view->size = view->len;
+        return view;
+    }
+    return (Line*)(scanner->current);
+}
 int scanner_hasNext(Scanner* const scanner)
 {
+    if ( scanner->mode == SCANNER_MODE_STREAM ) {
+        // NOTE: optimistic, a pipe might still be closed with no more data
+        return scanner->pos + scanner->view.len < scanner->buff->count
+            || !scanner->eof;
+    }
+    if ( scanner->mode == SCANNER_MODE_MMAP ) {
+        return scanner->line_index + 1 < scanner->line_count;
+    }
     return scanner->current->next != NULL;
 }
 
 int scanner_load(Scanner* const scanner, const char* const file_name)
 {
-    printf("[SCANNER](%s) --> START\n", file_name);
+    LOG_DEBUGF(LOG_SCANNER, "(%s) --> START", file_name);
     FILE* f = fopen(file_name, "rb");
     if ( f == NULL ) {
         perror("fopen");
         return SCANNER_FAIL;
     }
 
+    *scanner = (Scanner) { 0 };
     list_init(&scanner->lines);
     scanner->file_name = file_name;
+    scanner->mode = SCANNER_MODE_LINES;
 
     errno = 0;
 
     while ( 1 ) {
-        Line* line = list_node_new(sizeof(Line));
+        Line* line = list_node_new(MEM_SCANNER, sizeof(Line));
         if ( line == NULL ) {
             perror("malloc");
             fclose(f);
@@ -98,7 +209,7 @@ int scanner_load(Scanner* const scanner, const char* const file_name)
         line->size = 0;
 
         if ( get_line(line, f) == -1 ) {
-            free(line);
+            mem_free(line);
             break;
         }
 
@@ -114,17 +225,314 @@ int scanner_load(Scanner* const scanner, const char* const file_name)
 
     scanner->current = scanner->lines.head;
 
-    printf("[SCANNER](%s) <-- END\n", file_name);
+    LOG_DEBUGF(LOG_SCANNER, "(%s) <-- END", file_name);
 
     fclose(f);
 
-    printf("[FILE](%s) --> START\n", file_name);
-    int i = 0;
-    list_foreach(Line * line, scanner->lines)
-    {
-        printf("%6d: %s", i++, line->data);
+#if LOG_LEVEL_TRACE <= LOG_LEVEL_MAX
+    if ( LOG_ENABLED(TRACE, LOG_SCANNER) ) {
+        int i = 0;
+        list_foreach(Line * line, scanner->lines)
+        {
+            LOG_TRACEF(LOG_SCANNER, "%6d: %.*s", i++, (int)line_trim_len(line),
+                line->data);
+        }
+    }
+#endif
+
+    return SCANNER_SUCCESS;
+}
+
+
+// builds the offset index: offsets[i] is the start of line i and
+// offsets[line_count] the end of the source, one allocation for all lines.
+static int scanner_index_lines(Scanner* const scanner)
+{
+    const char* const src = scanner->src;
+    const char* const end = src + scanner->src_len;
+
+    size_t cap = FILE_MAX_LINES;
+    size_t count = 0;
+    size_t* offsets = mem_alloc(MEM_SCANNER, sizeof(size_t) * (cap + 1));
+    if ( offsets == NULL ) { return SCANNER_FAIL; }
+
+    for ( const char* p = src; p < end; ) {
+        if ( count == cap ) {
+            cap *= 2;
+            size_t* ptr
+                = mem_realloc(MEM_SCANNER, offsets, sizeof(size_t) * (cap + 1));
+            if ( ptr == NULL ) {
+                mem_free(offsets);
+                return SCANNER_FAIL;
+            }
+            offsets = ptr;
+        }
+        offsets[count++] = p - src;
+
+        const size_t n = simd_find_newline(p, end - p);
+        p = (p + n < end) ? p + n + 1 : end;
+    }
+    offsets[count] = scanner->src_len;
+
+    scanner->offsets = offsets;
+    scanner->line_count = count;
+    scanner->line_cap = cap;
+    scanner->line_index = 0;
+    return SCANNER_SUCCESS;
+}
+// line of an offset inside src, binary search over the line index
+static size_t scanner_line(const Scanner* const scanner, size_t offset)
+{
+    size_t lo = 0, hi = scanner->line_count;
+    while ( lo + 1 < hi ) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if ( scanner->offsets[mid] <= offset ) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// source offset to row/col, binary search over the line index
+void scanner_locate(const Scanner* const scanner, size_t offset, Location* loc)
+{
+    { // sanity check
+        ASSERT(scanner != NULL);
+        ASSERT(scanner->mode == SCANNER_MODE_MMAP);
+        ASSERT(loc != NULL);
+    }
+
+    loc->file_name = scanner->file_name;
+    if ( scanner->src_len <= offset ) { // EOF, same as the tokenizer
+        loc->row = scanner->line_count;
+        loc->col = 0;
+        return;
+    }
+
+    loc->row = scanner_line(scanner, offset);
+    loc->col = offset - scanner->offsets[loc->row];
+}
+
+int scanner_mmap(Scanner* const scanner, const char* const file_name)
+{
+    { // sanity check
+        ASSERT(scanner != NULL);
+        ASSERT(file_name != NULL);
+    }
+
+    *scanner = (Scanner) { 0 };
+    list_init(&scanner->lines);
+    scanner->file_name = file_name;
+    scanner->mode = SCANNER_MODE_MMAP;
+
+    const int fd = open(file_name, O_RDONLY);
+    if ( fd == -1 ) {
+        perror("open");
+        return SCANNER_FAIL;
+    }
+
+    struct stat st;
+    if ( fstat(fd, &st) == -1 ) {
+        perror("fstat");
+        close(fd);
+        return SCANNER_FAIL;
+    }
+    if ( !S_ISREG(st.st_mode) ) {
+        LOG_ERRF("%s: can't mmap a non regular file", file_name);
+        close(fd);
+        return SCANNER_FAIL;
+    }
+
+    const size_t len = st.st_size;
+    const size_t page = sysconf(_SC_PAGESIZE);
+
+    // NOTE: reserve an anonymous zeroed region one byte bigger than the file
+    //       and map the file over it, so src[len] is a '\0' sentinel even
+    //       when the file size is a multiple of the page size.
+    const size_t map_len = DATA_ROUND_UP(len + 1, page);
+    char* base = mmap(
+        NULL, map_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ( base == MAP_FAILED ) {
+        perror("mmap");
+        close(fd);
+        return SCANNER_FAIL;
+    }
+    if ( len != 0
+        && mmap(base, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0)
+            == MAP_FAILED ) {
+        perror("mmap");
+        munmap(base, map_len);
+        close(fd);
+        return SCANNER_FAIL;
+    }
+    close(fd);
+
+    scanner->src = base;
+    scanner->src_len = len;
+    scanner->map_len = map_len;
+
+    if ( scanner_index_lines(scanner) == SCANNER_FAIL ) {
+        perror("malloc");
+        scanner_free(scanner);
+        return SCANNER_FAIL;
+    }
+    LOG_DEBUGF(LOG_SCANNER, "(%s) mapped %zu bytes, %zu lines", file_name,
+        scanner->src_len, scanner->line_count);
+
+    return SCANNER_SUCCESS;
+}
+
+// NOTE: the mapping is read-only and sized to the file, an edited source
+//       needs its own copy
+int scanner_own(Scanner* const scanner)
+{
+    { // sanity check
+        ASSERT(scanner != NULL);
+        ASSERT(scanner->mode == SCANNER_MODE_MMAP);
+        ASSERT(scanner->src_cap == 0);
+    }
+
+    const size_t cap = scanner->src_len + 1;
+    char* src = mem_alloc(MEM_SCANNER, cap);
+    if ( src == NULL ) { return SCANNER_FAIL; }
+    memcpy(src, scanner->src, scanner->src_len);
+    src[scanner->src_len] = '\0';
+
+    if ( scanner->src != NULL ) {
+        munmap((void*)scanner->src, scanner->map_len);
+    }
+    scanner->src = src;
+    scanner->src_cap = cap;
+    scanner->map_len = 0;
+    return SCANNER_SUCCESS;
+}
+// NOTE: replaces src[offset .. offset + deleted] with text. only the lines
+//       the edit touches are indexed again, the offsets of the ones after it
+//       are moved. a line is touched if the edit starts in it, ends in it
+//       (the '\n' of the one before might be gone) or is inserted.
+int scanner_edit(Scanner* const scanner, size_t offset, size_t deleted,
+    const char* text, size_t len, Line_Edit* edit)
+{
+    { // sanity check
+        ASSERT(scanner != NULL);
+        ASSERT(scanner->src_cap != 0);
+        ASSERT(offset <= scanner->src_len);
+        ASSERT(deleted <= scanner->src_len - offset);
+        ASSERT(text != NULL || len == 0);
+        ASSERT(edit != NULL);
+    }
+
+    const size_t old_len = scanner->src_len;
+    const size_t new_len = old_len - deleted + len;
+    const size_t count = scanner->line_count;
+    const int open = (old_len != 0 && scanner->src[old_len - 1] != '\n');
+
+    // old lines [first, old_end), offset == src_len is in the last line if it
+    // has no '\n', else in a new one
+    const size_t first = (offset < old_len) ? scanner_line(scanner, offset)
+                                            : count - open;
+    const size_t last = (offset + deleted < old_len)
+        ? scanner_line(scanner, offset + deleted)
+        : count - open;
+    const size_t old_end = (last < count) ? last + 1 : count;
+
+    { // text
+        if ( scanner->src_cap < new_len + 1 ) {
+            size_t cap = scanner->src_cap * 2;
+            if ( cap < new_len + 1 ) { cap = new_len + 1; }
+            char* src = mem_realloc(MEM_SCANNER, (void*)scanner->src, cap);
+            if ( src == NULL ) { return SCANNER_FAIL; }
+            scanner->src = src;
+            scanner->src_cap = cap;
+        }
+        char* src = (char*)scanner->src;
+        memmove(&src[offset + len], &src[offset + deleted],
+            old_len - offset - deleted);
+        memcpy(&src[offset], text, len);
+        src[new_len] = '\0';
+        scanner->src_len = new_len;
+    }
+
+    const char* const src = scanner->src;
+    const size_t begin = scanner->offsets[first];
+    const size_t end = scanner->offsets[old_end] - deleted + len;
+
+    size_t lines = 0; // in [begin, end) now
+    for ( size_t p = begin; p < end; lines++ ) {
+        const size_t n = simd_find_newline(&src[p], end - p);
+        p = (p + n < end) ? p + n + 1 : end;
+    }
+
+    const size_t new_count = count - (old_end - first) + lines;
+    if ( scanner->line_cap < new_count ) {
+        size_t cap = scanner->line_cap * 2;
+        if ( cap < new_count ) { cap = new_count; }
+        size_t* offsets = mem_realloc(
+            MEM_SCANNER, scanner->offsets, sizeof(size_t) * (cap + 1));
+        if ( offsets == NULL ) { return SCANNER_FAIL; }
+        scanner->offsets = offsets;
+        scanner->line_cap = cap;
+    }
+
+    { // index
+        size_t* const offsets = scanner->offsets;
+        memmove(&offsets[first + lines], &offsets[old_end],
+            sizeof(size_t) * (count + 1 - old_end));
+        for ( size_t i = first + lines; i <= new_count; i++ ) {
+            offsets[i] += len - deleted; // NOTE: wraps around on a shrink
+        }
+        size_t i = first;
+        for ( size_t p = begin; p < end; ) {
+            offsets[i++] = p;
+            const size_t n = simd_find_newline(&src[p], end - p);
+            p = (p + n < end) ? p + n + 1 : end;
+        }
+        scanner->line_count = new_count;
+    }
+
+    *edit = (Line_Edit) {
+        .first = first,
+        .old_end = old_end,
+        .new_end = first + lines,
+    };
+    return SCANNER_SUCCESS;
+}
+
+int scanner_stream(Scanner* const scanner, const char* const file_name)
+{
+    { // sanity check
+        ASSERT(scanner != NULL);
+        ASSERT(file_name != NULL);
     }
-    printf("[FILE](%s) <-- END\n", file_name);
+
+    *scanner = (Scanner) { 0 };
+    list_init(&scanner->lines);
+    scanner->mode = SCANNER_MODE_STREAM;
+
+    if ( strcmp(file_name, "-") == 0 ) {
+        scanner->file_name = "<stdin>";
+        scanner->fd = STDIN_FILENO;
+    } else {
+        scanner->file_name = file_name;
+        scanner->fd = open(file_name, O_RDONLY);
+        if ( scanner->fd == -1 ) {
+            perror("open");
+            return SCANNER_FAIL;
+        }
+    }
+
+    char* blob = mem_alloc(MEM_SCANNER, SCANNER_BUFF_SIZE);
+    if ( blob == NULL ) {
+        perror("malloc");
+        if ( scanner->fd != STDIN_FILENO ) { close(scanner->fd); }
+        return SCANNER_FAIL;
+    }
+    scanner->buff = buff_init(blob, SCANNER_BUFF_SIZE);
+    scanner->buff->data[0] = '\0';
+    LOG_DEBUGF(LOG_SCANNER, "(%s) streaming with a %d bytes window",
+        scanner->file_name, SCANNER_BUFF_SIZE);
 
     return SCANNER_SUCCESS;
 }
@@ -132,10 +540,25 @@ int scanner_load(Scanner* const scanner, const char* const file_name)
 
 int scanner_free(Scanner* const scanner)
 {
-    list_foreach(Line * line, scanner->lines)
-    {
-        free(line->data);
-        free(line);
+    if ( scanner->mode == SCANNER_MODE_STREAM ) {
+        if ( scanner->fd != STDIN_FILENO ) { close(scanner->fd); }
+        mem_free(scanner->buff);
+        scanner->buff = NULL;
+        return SCANNER_SUCCESS;
+    }
+    if ( scanner->mode == SCANNER_MODE_MMAP ) {
+        if ( scanner->src_cap != 0 ) {
+            mem_free((void*)scanner->src);
+        } else if ( scanner->src != NULL ) {
+            munmap((void*)scanner->src, scanner->map_len);
+        }
+        mem_free(scanner->offsets);
+        scanner->src = NULL;
+        scanner->offsets = NULL;
+        return SCANNER_SUCCESS;
     }
+
+    list_foreach(Line * line, scanner->lines) { mem_free((void*)line->data); }
+    list_free(&scanner->lines);
     return SCANNER_SUCCESS;
 }
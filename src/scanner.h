@@ -9,23 +9,75 @@ enum {
     SCANNER_FAIL = 1,
 };
 
+typedef enum {
+    SCANNER_MODE_LINES,  // fgetc + one heap Line per line
+    SCANNER_MODE_MMAP,   // read-only mmap + line offset index, zero copy
+    SCANNER_MODE_STREAM, // read() into a fixed SCANNER_BUFF_SIZE window
+} scanner_mode_t;
+
 typedef struct {
     SIGN_CONTRACT_LL(node);
     size_t len;
     size_t size;
-    char* data;
+    const char* data;
 } Line;
 VALIDATE_CONTRACT_LL(Line, node)
 
 typedef struct Scanner_s {
     const char* file_name;
+    scanner_mode_t mode;
+    // SCANNER_MODE_LINES
     List lines;
     List_Node* current;
+    // SCANNER_MODE_MMAP
+    // NOTE: src[src_len] is always '\0', lines are views into src:
+    //           line i := src[offsets[i] .. offsets[i + 1]]
+    //       after scanner_own src is a heap copy (src_cap != 0) instead of
+    //       the mapping, so scanner_edit can change it.
+    const char* src;
+    size_t src_len;
+    size_t src_cap;
+    size_t map_len;
+    size_t* offsets;
+    size_t line_count;
+    size_t line_cap;
+    size_t line_index;
+    // SCANNER_MODE_STREAM
+    // NOTE: the current line is buff->data[pos .. pos + view.len], whole lines
+    //       are always in the window so tokens never cross a refill.
+    Buffer* buff;
+    size_t pos;
+    int fd;
+    int eof;
+    int failed;
+    Line view; // line handed out by scanner_peek/scanner_next
 } Scanner;
 
 extern int scanner_load(Scanner* const scanner, const char* const file_name);
+extern int scanner_mmap(Scanner* const scanner, const char* const file_name);
+extern int scanner_stream(Scanner* const scanner, const char* const file_name);
 extern int scanner_free(Scanner* const scanner);
 
+// lines [first, old_end) of the old source are [first, new_end) now
+typedef struct Line_Edit_s {
+    size_t first;
+    size_t old_end;
+    size_t new_end;
+} Line_Edit;
+
+extern int scanner_own(Scanner* const scanner);
+extern int scanner_edit(Scanner* const scanner, size_t offset, size_t deleted,
+    const char* text, size_t len, Line_Edit* edit);
+
+// length of the line without its trailing '\n', for logs and diagnostics
+static inline size_t line_trim_len(const Line* line)
+{
+    return line->len - (line->len != 0 && line->data[line->len - 1] == '\n');
+}
+
+extern void scanner_locate(
+    const Scanner* const scanner, size_t offset, Location* loc);
+
 extern Line* scanner_next(Scanner* const scanner);
 extern Line* scanner_peek(Scanner* const scanner);
 extern int scanner_hasNext(Scanner* const scanner);
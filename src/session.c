@@ -0,0 +1,322 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "session.h"
+#include "utils.h"
+
+static void session_grow(Session_Stmt** stmts, size_t* cap, size_t count)
+{
+    if ( count <= *cap ) { return; }
+
+    size_t new_cap = (*cap == 0) ? SESSION_STMT_SIZE : *cap * 2;
+    while ( new_cap < count ) { new_cap *= 2; }
+    Session_Stmt* data
+        = mem_realloc(MEM_AST, *stmts, sizeof(Session_Stmt) * new_cap);
+    if ( data == NULL ) {
+        LOG_ERR("out of memory");
+        exit(EXIT_FAILURE);
+    }
+    *stmts = data;
+    *cap = new_cap;
+}
+
+// first statement that ends at or after row
+static size_t session_find(const Session* s, size_t row)
+{
+    size_t lo = 0, hi = s->stmt_count;
+    while ( lo < hi ) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if ( s->stmts[mid].last_row < row ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// parses lines [first, end) into s->fresh, through a view over them like the
+// parallel lexer does
+static int session_parse(Session* s, size_t first, size_t end)
+{
+    AST* ast = &s->ast;
+    Tokenizer0 view = { .loc = { .row = first, .col = 0 } };
+    view.scanner = s->tok.scanner;
+    view.scanner.line_index = first;
+    view.scanner.line_count = end;
+    ast_set_tokenizer(ast, &view);
+
+    int status = SESSION_SUCCESS;
+    s->fresh_count = 0;
+    while ( !ast_at_eof(ast) ) {
+        session_grow(&s->fresh, &s->fresh_cap, s->fresh_count + 1);
+
+        const size_t node_begin = ast->node_count;
+        const size_t tok_begin = ast->tok_count;
+        size_t first_row, last_row;
+        const ast_ref_t node = ast_parse_stmt(ast, &first_row, &last_row);
+        if ( node == AST_NULL ) {
+            status = SESSION_SYNTAX;
+            break;
+        }
+        s->fresh[s->fresh_count++] = (Session_Stmt) {
+            .node = node,
+            .node_begin = (uint32_t)node_begin,
+            .node_end = (uint32_t)ast->node_count,
+            .tok_begin = (uint32_t)tok_begin,
+            .tok_end = (uint32_t)ast->tok_count,
+            .first_row = (uint32_t)first_row,
+            .last_row = (uint32_t)last_row,
+            .shift = 0,
+        };
+    }
+
+    ast_set_tokenizer(ast, &s->tok); // NOTE: view is gone after this
+    return status;
+}
+
+// root -> stmts[lo] -> ... -> stmts[hi - 1] -> stmts[hi]
+static void session_link(Session* s, size_t lo, size_t hi)
+{
+    AST_Node* nodes = s->ast.nodes;
+    ast_ref_t next = (hi < s->stmt_count) ? s->stmts[hi].node : AST_NULL;
+    for ( size_t i = hi; lo < i; i-- ) {
+        nodes[s->stmts[i - 1].node].next_sibling = next;
+        next = s->stmts[i - 1].node;
+    }
+    if ( lo == 0 ) {
+        nodes[s->ast.root].first_child = next;
+    } else {
+        nodes[s->stmts[lo - 1].node].next_sibling = next;
+    }
+}
+
+// stmts[lo, hi) are replaced by the fresh ones, the ones after them moved
+// rows lines down
+static void session_splice(Session* s, size_t lo, size_t hi, ptrdiff_t rows)
+{
+    const size_t fresh = s->fresh_count;
+    const size_t count = s->stmt_count - (hi - lo) + fresh;
+    session_grow(&s->stmts, &s->stmt_cap, count);
+
+    Session_Stmt* const stmts = s->stmts;
+    for ( size_t i = lo; i < hi; i++ ) {
+        s->garbage += stmts[i].node_end - stmts[i].node_begin;
+    }
+    if ( rows != 0 ) {
+        for ( size_t i = hi; i < s->stmt_count; i++ ) {
+            stmts[i].first_row += (uint32_t)rows;
+            stmts[i].last_row += (uint32_t)rows;
+            stmts[i].shift += (int32_t)rows;
+        }
+    }
+    if ( hi - lo != fresh ) {
+        memmove(&stmts[lo + fresh], &stmts[hi],
+            sizeof(Session_Stmt) * (s->stmt_count - hi));
+    }
+    memcpy(&stmts[lo], s->fresh, sizeof(Session_Stmt) * fresh);
+    s->stmt_count = count;
+    s->fresh_count = 0;
+
+    session_link(s, lo, lo + fresh);
+}
+
+// NOTE: replaced statements leave their nodes behind, once they outweigh the
+//       live ones the tables are copied again in statement order. the nodes
+//       of a statement only refer to each other, so moving one is moving all
+//       its refs by the same amount, the links between statements are redone.
+static void session_compact(Session* s)
+{
+    AST* ast = &s->ast;
+    AST_Node* nodes = mem_alloc(MEM_AST, sizeof(AST_Node) * ast->node_cap);
+    AST_Token* toks = mem_alloc(MEM_AST, sizeof(AST_Token) * ast->tok_cap);
+    if ( nodes == NULL || toks == NULL ) { // NOTE: not fatal, just bigger
+        mem_free(nodes);
+        mem_free(toks);
+        return;
+    }
+
+    nodes[0] = ast->nodes[0]; // root
+    toks[0] = ast->tok_table[0]; // dummy
+    size_t n = 1, t = 1;
+    for ( size_t i = 0; i < s->stmt_count; i++ ) {
+        Session_Stmt* stmt = &s->stmts[i];
+        const size_t node_len = stmt->node_end - stmt->node_begin;
+        const size_t tok_len = stmt->tok_end - stmt->tok_begin;
+
+        for ( size_t j = 0; j < node_len; j++ ) {
+            AST_Node node = ast->nodes[stmt->node_begin + j];
+            if ( node.first_child != AST_NULL ) {
+                node.first_child = node.first_child - stmt->node_begin + n;
+            }
+            if ( node.next_sibling != AST_NULL ) {
+                node.next_sibling = node.next_sibling - stmt->node_begin + n;
+            }
+            if ( node.token != 0 ) {
+                node.token = node.token - stmt->tok_begin + t;
+            }
+            nodes[n + j] = node;
+        }
+        for ( size_t j = 0; j < tok_len; j++ ) {
+            toks[t + j] = ast->tok_table[stmt->tok_begin + j];
+            toks[t + j].row += (uint32_t)stmt->shift;
+        }
+
+        stmt->node = stmt->node - stmt->node_begin + n;
+        stmt->node_begin = (uint32_t)n;
+        stmt->node_end = (uint32_t)(n + node_len);
+        stmt->tok_begin = (uint32_t)t;
+        stmt->tok_end = (uint32_t)(t + tok_len);
+        stmt->shift = 0;
+        n += node_len;
+        t += tok_len;
+    }
+    LOG_DEBUGF(LOG_AST, "compacted %zu nodes to %zu", ast->node_count, n);
+
+    mem_free(ast->nodes);
+    mem_free(ast->tok_table);
+    ast->nodes = nodes;
+    ast->tok_table = toks;
+    ast->node_count = n;
+    ast->tok_count = t;
+    s->garbage = 0;
+    session_link(s, 0, s->stmt_count);
+}
+
+int session_open(Session* s, const char* file_name)
+{
+    { // sanity check
+        ASSERT(s != NULL);
+        ASSERT(file_name != NULL);
+    }
+
+    *s = (Session) { 0 };
+    if ( tok_init(&s->tok, file_name, SCANNER_MODE_MMAP) == TOKENIZER_FAIL ) {
+        return SESSION_FAIL;
+    }
+    if ( scanner_own(&s->tok.scanner) == SCANNER_FAIL
+        || !npool_init(&s->identifiers, NULL)
+        || !spool_init(&s->strings, NULL) ) {
+        LOG_ERR("failed to setup the session");
+        npool_free(&s->identifiers);
+        spool_free(&s->strings);
+        scanner_free(&s->tok.scanner);
+        return SESSION_FAIL;
+    }
+    ast_init(&s->ast, &s->tok, &s->identifiers, &s->strings);
+    ast_begin(&s->ast);
+
+    // NOTE: the whole file is a single edit with nothing to replace
+    const size_t end = s->tok.scanner.line_count;
+    const size_t node_mark = s->ast.node_count;
+    const size_t tok_mark = s->ast.tok_count;
+    const int status = session_parse(s, 0, end);
+    if ( status != SESSION_SUCCESS ) {
+        s->fresh_count = 0;
+        s->ast.node_count = node_mark;
+        s->ast.tok_count = tok_mark;
+        s->dirty_end = end;
+    }
+    session_splice(s, 0, 0, 0);
+    return status;
+}
+
+// NOTE: the lines of the edit (and the ones that didn't parse before) are
+//       parsed again, grown to whole statements: a statement that shares a
+//       line with them is parsed again too, the lexer only restarts at the
+//       beginning of a line. a statement ends at its ';' so whatever doesn't
+//       parse in the region doesn't parse in the whole file either.
+int session_edit(
+    Session* s, size_t offset, size_t deleted, const char* text, size_t len)
+{
+    { // sanity check
+        ASSERT(s != NULL);
+    }
+
+    Line_Edit edit;
+    if ( scanner_edit(&s->tok.scanner, offset, deleted, text, len, &edit)
+        == SCANNER_FAIL ) {
+        LOG_ERR("failed to edit the source");
+        return SESSION_FAIL;
+    }
+    const ptrdiff_t rows = (ptrdiff_t)edit.new_end - (ptrdiff_t)edit.old_end;
+
+    // old lines [first, end) with the statements [lo, hi) on them
+    size_t first = edit.first, end = edit.old_end;
+    if ( s->dirty_first != s->dirty_end ) {
+        if ( s->dirty_first < first ) { first = s->dirty_first; }
+        if ( end < s->dirty_end ) { end = s->dirty_end; }
+    }
+    size_t lo = session_find(s, first), hi = lo;
+    while ( hi < s->stmt_count && s->stmts[hi].first_row < end ) {
+        if ( end <= s->stmts[hi].last_row ) { end = s->stmts[hi].last_row + 1; }
+        hi++;
+    }
+    if ( lo < hi && s->stmts[lo].first_row < first ) {
+        first = s->stmts[lo].first_row;
+    }
+    while ( 0 < lo && first <= s->stmts[lo - 1].last_row ) {
+        lo--;
+        if ( s->stmts[lo].first_row < first ) {
+            first = s->stmts[lo].first_row;
+        }
+    }
+    end += rows;
+    LOG_DEBUGF(LOG_AST, "edit: lines %zu..%zu, %zu statements", first, end,
+        hi - lo);
+
+    const size_t node_mark = s->ast.node_count;
+    const size_t tok_mark = s->ast.tok_count;
+    const int status = session_parse(s, first, end);
+    if ( status == SESSION_SUCCESS ) {
+        s->dirty_first = s->dirty_end = 0;
+    } else {
+        s->fresh_count = 0;
+        s->ast.node_count = node_mark;
+        s->ast.tok_count = tok_mark;
+        s->dirty_first = first;
+        s->dirty_end = end;
+    }
+    session_splice(s, lo, hi, rows);
+
+    const size_t live = s->ast.node_count - s->garbage;
+    if ( live + AST_BUFF_SIZE < s->garbage ) { session_compact(s); }
+    return status;
+}
+
+// NOTE: the AST of the current source, NULL while it doesn't parse. the rows
+//       of the tokens are brought up to date here rather than on every edit.
+const AST* session_ast(Session* s)
+{
+    { // sanity check
+        ASSERT(s != NULL);
+    }
+
+    if ( s->dirty_first != s->dirty_end ) { return NULL; }
+
+    for ( size_t i = 0; i < s->stmt_count; i++ ) {
+        Session_Stmt* stmt = &s->stmts[i];
+        if ( stmt->shift == 0 ) { continue; }
+        for ( size_t t = stmt->tok_begin; t < stmt->tok_end; t++ ) {
+            s->ast.tok_table[t].row += (uint32_t)stmt->shift;
+        }
+        stmt->shift = 0;
+    }
+    return &s->ast;
+}
+
+void session_free(Session* s)
+{
+    ast_free(&s->ast);
+    npool_free(&s->identifiers);
+    spool_free(&s->strings);
+    scanner_free(&s->tok.scanner);
+    mem_free(s->stmts);
+    mem_free(s->fresh);
+    s->stmts = s->fresh = NULL;
+    s->stmt_count = s->stmt_cap = 0;
+    s->fresh_count = s->fresh_cap = 0;
+}
@@ -0,0 +1,62 @@
+#ifndef _SESSION_H
+#define _SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ast.h"
+#include "string_pool.h"
+#include "tokenizer.h"
+
+enum {
+    SESSION_SUCCESS = 0,
+    SESSION_FAIL = 1,
+    SESSION_SYNTAX = -1, // the source doesn't parse, an edit can fix it
+};
+
+// NOTE: a top-level statement, its nodes and tokens are the ranges
+//       [node_begin, node_end) and [tok_begin, tok_end) of the AST tables.
+//       the rows are always current, shift is what the rows of its tokens
+//       still have to move (see session_ast).
+typedef struct Session_Stmt_s {
+    ast_ref_t node;
+    uint32_t node_begin;
+    uint32_t node_end;
+    uint32_t tok_begin;
+    uint32_t tok_end;
+    uint32_t first_row;
+    uint32_t last_row;
+    int32_t shift;
+} Session_Stmt;
+
+// NOTE: a source kept in memory across edits (an editor buffer, a watch
+//       mode). an edit re-lexes only the lines it touches and re-parses only
+//       the statements on them, the rest of the AST is kept as is.
+//       stmts are the root children in source order. lines
+//       [dirty_first, dirty_end) didn't parse, they go with the next edit.
+//       the AST points into the session, so it can't be moved once open.
+typedef struct Session_s {
+    Tokenizer0 tok;
+    Null_Pool identifiers;
+    Span_Pool strings;
+    AST ast;
+
+    Session_Stmt* stmts;
+    size_t stmt_count;
+    size_t stmt_cap;
+    Session_Stmt* fresh; // parsed by the last edit
+    size_t fresh_count;
+    size_t fresh_cap;
+
+    size_t dirty_first;
+    size_t dirty_end;
+    size_t garbage; // nodes of replaced statements
+} Session;
+
+extern int session_open(Session* s, const char* file_name);
+extern int session_edit(Session* s, size_t offset, size_t deleted,
+    const char* text, size_t len);
+extern const AST* session_ast(Session* s);
+extern void session_free(Session* s);
+
+#endif // !_SESSION_H
@@ -0,0 +1,151 @@
+
+#include <stddef.h>
+
+#include "simd.h"
+
+#if !defined(CARMEN_NO_SIMD) && defined(__SSE2__)
+#    include <emmintrin.h>
+#    define SIMD_SSE2
+#endif
+#if !defined(CARMEN_NO_SIMD) && defined(__AVX2__)
+#    include <immintrin.h>
+#    define SIMD_AVX2
+#endif
+
+/*****************************************************************************/
+/** scalar *******************************************************************/
+
+// NOTE: same classes as the lexer char_class table, without ctype
+static inline int scalar_is_space(unsigned char c)
+{
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+static inline int scalar_is_ident(unsigned char c)
+{
+    return (unsigned char)((c | 0x20) - 'a') <= 'z' - 'a'
+        || (unsigned char)(c - '0') <= '9' - '0' || c == '_';
+}
+
+/*****************************************************************************/
+/** sse2 *********************************************************************/
+
+// NOTE: unsigned range check: x in [lo, lo + n] <=> min(x - lo, n) == x - lo
+
+#ifdef SIMD_SSE2
+static inline unsigned sse2_in_range(__m128i v, char lo, char n)
+{
+    const __m128i d = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    const __m128i in = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(n)), d);
+    return _mm_movemask_epi8(in);
+}
+static inline unsigned sse2_space_mask(__m128i v)
+{
+    const __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    return _mm_movemask_epi8(sp) | sse2_in_range(v, '\t', '\r' - '\t');
+}
+static inline unsigned sse2_ident_mask(__m128i v)
+{
+    const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    const __m128i us = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+    return sse2_in_range(lower, 'a', 'z' - 'a')
+        | sse2_in_range(v, '0', '9' - '0') | _mm_movemask_epi8(us);
+}
+static inline unsigned sse2_newline_mask(__m128i v)
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+}
+#    define SSE2_LOAD(ptr) _mm_loadu_si128((const __m128i*)(ptr))
+#endif // SIMD_SSE2
+
+/*****************************************************************************/
+/** avx2 *********************************************************************/
+
+#ifdef SIMD_AVX2
+static inline unsigned avx2_in_range(__m256i v, char lo, char n)
+{
+    const __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    const __m256i in
+        = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(n)), d);
+    return (unsigned)_mm256_movemask_epi8(in);
+}
+static inline unsigned avx2_space_mask(__m256i v)
+{
+    const __m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    return (unsigned)_mm256_movemask_epi8(sp)
+        | avx2_in_range(v, '\t', '\r' - '\t');
+}
+static inline unsigned avx2_ident_mask(__m256i v)
+{
+    const __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    const __m256i us = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+    return avx2_in_range(lower, 'a', 'z' - 'a')
+        | avx2_in_range(v, '0', '9' - '0')
+        | (unsigned)_mm256_movemask_epi8(us);
+}
+static inline unsigned avx2_newline_mask(__m256i v)
+{
+    const __m256i nl = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+    return (unsigned)_mm256_movemask_epi8(nl);
+}
+#    define AVX2_LOAD(ptr) _mm256_loadu_si256((const __m256i*)(ptr))
+#endif // SIMD_AVX2
+
+/*****************************************************************************/
+
+// NOTE: `mask` has a bit set for every byte in the run, the first clear bit
+//       is where the run stops.
+
+size_t simd_skip_space(const char* str, size_t len)
+{
+    size_t i = 0;
+#ifdef SIMD_AVX2
+    for ( ; i + 32 <= len; i += 32 ) {
+        const unsigned stop = ~avx2_space_mask(AVX2_LOAD(&str[i]));
+        if ( stop != 0 ) { return i + __builtin_ctz(stop); }
+    }
+#endif
+#ifdef SIMD_SSE2
+    for ( ; i + 16 <= len; i += 16 ) {
+        const unsigned stop = ~sse2_space_mask(SSE2_LOAD(&str[i])) & 0xffff;
+        if ( stop != 0 ) { return i + __builtin_ctz(stop); }
+    }
+#endif
+    while ( i < len && scalar_is_space(str[i]) ) { i++; }
+    return i;
+}
+size_t simd_ident_end(const char* str, size_t len)
+{
+    size_t i = 0;
+#ifdef SIMD_AVX2
+    for ( ; i + 32 <= len; i += 32 ) {
+        const unsigned stop = ~avx2_ident_mask(AVX2_LOAD(&str[i]));
+        if ( stop != 0 ) { return i + __builtin_ctz(stop); }
+    }
+#endif
+#ifdef SIMD_SSE2
+    for ( ; i + 16 <= len; i += 16 ) {
+        const unsigned stop = ~sse2_ident_mask(SSE2_LOAD(&str[i])) & 0xffff;
+        if ( stop != 0 ) { return i + __builtin_ctz(stop); }
+    }
+#endif
+    while ( i < len && scalar_is_ident(str[i]) ) { i++; }
+    return i;
+}
+size_t simd_find_newline(const char* str, size_t len)
+{
+    size_t i = 0;
+#ifdef SIMD_AVX2
+    for ( ; i + 32 <= len; i += 32 ) {
+        const unsigned hit = avx2_newline_mask(AVX2_LOAD(&str[i]));
+        if ( hit != 0 ) { return i + __builtin_ctz(hit); }
+    }
+#endif
+#ifdef SIMD_SSE2
+    for ( ; i + 16 <= len; i += 16 ) {
+        const unsigned hit = sse2_newline_mask(SSE2_LOAD(&str[i]));
+        if ( hit != 0 ) { return i + __builtin_ctz(hit); }
+    }
+#endif
+    while ( i < len && str[i] != '\n' ) { i++; }
+    return i;
+}
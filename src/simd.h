@@ -0,0 +1,19 @@
+#ifndef _SIMD_H
+#define _SIMD_H
+
+#include <stddef.h>
+
+// NOTE: byte classifiers for the lexer hot loops, they look at 16 (SSE2) or
+//       32 (AVX2, build with -mavx2) bytes per step and never read past
+//       str[len - 1]. build with -DCARMEN_NO_SIMD to get the scalar code.
+//       every function returns the index of the first byte that doesn't
+//       belong to the run, or len if the whole span does.
+
+// first byte that is not one of ' ', '\t', '\n', '\v', '\f', '\r'
+extern size_t simd_skip_space(const char* str, size_t len);
+// first byte that is not one of [a-zA-Z0-9_]
+extern size_t simd_ident_end(const char* str, size_t len);
+// first '\n'
+extern size_t simd_find_newline(const char* str, size_t len);
+
+#endif // !_SIMD_H
@@ -1,9 +1,12 @@
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "config.h"
 #include "string_pool.h"
 #include "utils.h"
 
@@ -29,17 +32,24 @@ static void* pool_get(const Pool* pool, size_t offset)
 
     return (void*)&pool->data[offset];
 }
-
-/*****************************************************************************/
-
-static Pool* spool_new(Span_Pool* spool, size_t size)
+// FNV-1a
+static uint32_t pool_hash(const char* str, size_t n)
 {
-    { // sanity check
-        ASSERT(spool != NULL);
+    uint32_t hash = 2166136261u;
+    for ( size_t i = 0; i < n; i++ ) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
     }
+    return hash;
+}
 
-    Pool* pool = list_node_new(sizeof(Pool) + size);
-    if ( spool == NULL ) { return NULL; }
+// NOTE: blocks from a context are released with it, not by list_free
+static Pool* pool_new(Context* ctx, size_t size)
+{
+    Pool* pool = (ctx != NULL)
+        ? mem_context_alloc(ctx, MEM_POOLS, sizeof(Pool) + size)
+        : list_node_new(MEM_POOLS, sizeof(Pool) + size);
+    if ( pool == NULL ) { return NULL; }
 
     { // setup pool
         pool->node.next = NULL;
@@ -47,15 +57,80 @@ static Pool* spool_new(Span_Pool* spool, size_t size)
         pool->pivot = 0;
     }
 
+    return pool;
+}
+static void pool_free(List* pools, const Context* ctx)
+{
+    if ( ctx == NULL ) {
+        list_free(pools);
+    } else {
+        list_foreach(const Pool* pool, *pools)
+        {
+            mem_context_release(MEM_POOLS, sizeof(Pool) + pool->capacity);
+        }
+        list_init(pools);
+    }
+}
+
+/*****************************************************************************/
+
+static Pool* spool_new(Span_Pool* spool, size_t size)
+{
+    { // sanity check
+        ASSERT(spool != NULL);
+    }
+
+    Pool* pool = pool_new(spool->ctx, size);
+    if ( pool == NULL ) { return NULL; }
+
     list_push(&spool->pools, (void*)pool);
 
     return pool;
 }
-int spool_init(Span_Pool* spool)
+int spool_init(Span_Pool* spool, Context* ctx)
 {
+    *spool = (Span_Pool) {
+        .ctx = ctx,
+        .dedup = STRING_POOL_DEDUP,
+        .index_cap = STRING_POOL_SIZE,
+    };
     list_init(&spool->pools);
+    if ( spool->dedup ) {
+        spool->index
+            = mem_calloc(MEM_POOLS, spool->index_cap, sizeof(Span_Entry));
+        if ( spool->index == NULL ) { return false; }
+    }
     return spool_new(spool, POOL_BLOCK_SIZE) != NULL;
 }
+void spool_free(Span_Pool* spool)
+{
+    pool_free(&spool->pools, spool->ctx);
+    mem_free(spool->strings);
+    mem_free(spool->index);
+    spool->strings = NULL;
+    spool->index = NULL;
+    spool->count = 0;
+}
+static int spool_grow_index(Span_Pool* spool)
+{
+    const size_t cap = spool->index_cap * 2;
+    Span_Entry* index = mem_calloc(MEM_POOLS, cap, sizeof(Span_Entry));
+    if ( index == NULL ) { return false; }
+
+    for ( size_t i = 0; i < spool->index_cap; i++ ) {
+        const Span_Entry* entry = &spool->index[i];
+        if ( entry->id == 0 ) { continue; }
+
+        size_t j = entry->hash & (cap - 1);
+        while ( index[j].id != 0 ) { j = (j + 1) & (cap - 1); }
+        index[j] = *entry;
+    }
+
+    mem_free(spool->index);
+    spool->index = index;
+    spool->index_cap = cap;
+    return true;
+}
 static Span_String* spool__add(Pool* pool, const char* str, size_t n)
 {
 
@@ -75,16 +150,53 @@ Span_String* spool_add(Span_Pool* spool, const char* str, size_t n)
         ASSERT(str != NULL);
     }
 
-    const size_t N = n + sizeof(Span_String);
-    list_foreach(Pool * pool, spool->pools)
-    {
-        if ( pool->pivot + N <= pool->capacity ) { spool__add(pool, str, n); }
+    // find match
+    uint32_t hash = 0;
+    size_t i = 0;
+    if ( spool->dedup ) {
+        const size_t mask = spool->index_cap - 1;
+        hash = pool_hash(str, n);
+        for ( i = hash & mask; spool->index[i].id != 0; i = (i + 1) & mask ) {
+            Span_String* span = spool->strings[spool->index[i].id - 1];
+            if ( spool->index[i].hash == hash && span->size == n
+                && memcmp(span->str, str, n) == 0 ) {
+                return span;
+            }
+        }
+    }
+    if ( spool->count == UINT32_MAX - 1 ) { return NULL; }
+
+    if ( spool->count == spool->cap ) {
+        const size_t cap = (spool->cap == 0) ? 16 : spool->cap * 2;
+        void* strings = mem_realloc(
+            MEM_POOLS, spool->strings, sizeof(Span_String*) * cap);
+        if ( strings == NULL ) { return NULL; }
+        spool->strings = strings;
+        spool->cap = cap;
     }
 
-    Pool* pool = spool_new(spool, (POOL_BLOCK_SIZE < N) ? N : POOL_BLOCK_SIZE);
-    if ( pool == NULL ) { return NULL; }
+    // bump, only the tail pool can have room left
+    const size_t N = DATA_ROUND_UP(n + sizeof(Span_String), DATA_ALIGN);
+    Pool* pool = (Pool*)spool->pools.tail;
+    if ( pool == NULL || pool->capacity < pool->pivot + N ) {
+        pool = spool_new(spool, (POOL_BLOCK_SIZE < N) ? N : POOL_BLOCK_SIZE);
+        if ( pool == NULL ) { return NULL; }
+    }
+    Span_String* span = spool__add(pool, str, n);
+    span->id = spool->count;
+    spool->strings[spool->count++] = span;
+
+    if ( spool->dedup ) { // index it
+        spool->index[i] = (Span_Entry) {
+            .hash = hash,
+            .id = (uint32_t)spool->count,
+        };
+        if ( spool->index_cap < spool->count * 2 && !spool_grow_index(spool) ) {
+            return NULL;
+        }
+    }
 
-    return spool__add(pool, str, n);
+    return span;
 }
 void spool_print(const Span_Pool* spool)
 {
@@ -92,14 +204,9 @@ void spool_print(const Span_Pool* spool)
         ASSERT(spool != NULL);
     }
 
-    size_t j = 0;
-    list_foreach(Pool * pool, spool->pools)
-    {
-        for ( size_t i = 0; i < pool->pivot; i++ ) {
-            Span_String* span = pool_get(pool, i);
-            printf("%02zu:%03zu: \"%.*s\"\n", j, i, (int)span->size, span->str);
-            i += span->size;
-        }
+    for ( size_t i = 0; i < spool->count; i++ ) {
+        const Span_String* span = spool->strings[i];
+        printf("%03zu: \"%.*s\"\n", i, (int)span->size, span->str);
     }
 }
 
@@ -111,24 +218,50 @@ static Pool* npool_new(Null_Pool* npool, size_t size)
         ASSERT(npool != NULL);
     }
 
-    Pool* pool = list_node_new(sizeof(Pool) + size);
-    if ( npool == NULL ) { return NULL; }
-
-    { // setup pool
-        pool->node.next = NULL;
-        pool->capacity = size;
-        pool->pivot = 0;
-    }
+    Pool* pool = pool_new(npool->ctx, size);
+    if ( pool == NULL ) { return NULL; }
 
     list_push(&npool->pools, (void*)pool);
 
     return pool;
 }
-int npool_init(Null_Pool* npool)
+int npool_init(Null_Pool* npool, Context* ctx)
 {
+    *npool = (Null_Pool) {
+        .ctx = ctx,
+        .index_cap = IDENTIFIER_POOL_SIZE,
+    };
     list_init(&npool->pools);
+    npool->index = mem_calloc(MEM_POOLS, npool->index_cap, sizeof(uint32_t));
+    if ( npool->index == NULL ) { return false; }
     return npool_new(npool, POOL_BLOCK_SIZE) != NULL;
 }
+void npool_free(Null_Pool* npool)
+{
+    pool_free(&npool->pools, npool->ctx);
+    mem_free(npool->atoms);
+    mem_free(npool->index);
+    npool->atoms = NULL;
+    npool->index = NULL;
+    npool->count = 0;
+}
+static int npool_grow_index(Null_Pool* npool)
+{
+    const size_t cap = npool->index_cap * 2;
+    uint32_t* index = mem_calloc(MEM_POOLS, cap, sizeof(uint32_t));
+    if ( index == NULL ) { return false; }
+
+    for ( size_t i = 0; i < npool->count; i++ ) { // rehash with cached hashes
+        size_t j = npool->atoms[i].hash & (cap - 1);
+        while ( index[j] != 0 ) { j = (j + 1) & (cap - 1); }
+        index[j] = (uint32_t)i + 1;
+    }
+
+    mem_free(npool->index);
+    npool->index = index;
+    npool->index_cap = cap;
+    return true;
+}
 const char* npool__add(Pool* pool, const char* str, size_t n)
 {
 
@@ -140,37 +273,63 @@ const char* npool__add(Pool* pool, const char* str, size_t n)
 
     return ptr;
 }
-const char* npool_add(Null_Pool* npool, const char* str, const size_t n)
+atom_t npool_intern(Null_Pool* npool, const char* str, const size_t n)
 {
     { // sanity check
         ASSERT(npool != NULL);
         ASSERT(str != NULL);
+        ASSERT(n <= UINT32_MAX);
     }
 
     // find match
-    list_foreach(Pool * pool, npool->pools)
-    {
-        for ( size_t i = 0; i < pool->pivot; i++ ) {
-            const char* pstr = pool_get(pool, i);
-            size_t len = strlen(pstr);
-            if ( len == n && strncmp(pstr, str, n) == 0 ) { return pstr; }
-            i += len;
+    const size_t mask = npool->index_cap - 1;
+    const uint32_t hash = pool_hash(str, n);
+    size_t i = hash & mask;
+    for ( ; npool->index[i] != 0; i = (i + 1) & mask ) {
+        const atom_t atom = npool->index[i] - 1;
+        const Atom* entry = &npool->atoms[atom];
+        if ( entry->hash == hash && entry->len == n
+            && memcmp(entry->str, str, n) == 0 ) {
+            return atom;
         }
     }
+    if ( npool->count == ATOM_NONE - 1 ) { return ATOM_NONE; }
+
+    if ( npool->count == npool->cap ) {
+        const size_t cap = (npool->cap == 0) ? 64 : npool->cap * 2;
+        Atom* atoms = mem_realloc(MEM_POOLS, npool->atoms, sizeof(Atom) * cap);
+        if ( atoms == NULL ) { return ATOM_NONE; }
+        npool->atoms = atoms;
+        npool->cap = cap;
+    }
 
-    // add to pool
+    // add to pool, only the tail one can have room left
     const size_t N = n + 1;
-    list_foreach(Pool * pool, npool->pools)
-    {
-        if ( pool->pivot + N <= pool->capacity ) {
-            return npool__add(pool, str, n);
-        }
+    Pool* pool = (Pool*)npool->pools.tail;
+    if ( pool == NULL || pool->capacity < pool->pivot + N ) {
+        pool = npool_new(npool, (POOL_BLOCK_SIZE < N) ? N : POOL_BLOCK_SIZE);
+        if ( pool == NULL ) { return ATOM_NONE; }
     }
 
-    Pool* pool = npool_new(npool, (POOL_BLOCK_SIZE < N) ? N : POOL_BLOCK_SIZE);
-    if ( pool == NULL ) { return NULL; }
+    const atom_t atom = (atom_t)npool->count++;
+    npool->atoms[atom] = (Atom) {
+        .hash = hash,
+        .len = (uint32_t)n,
+        .str = npool__add(pool, str, n),
+    };
+
+    // index it
+    npool->index[i] = atom + 1;
+    if ( npool->index_cap < npool->count * 2 && !npool_grow_index(npool) ) {
+        return ATOM_NONE;
+    }
 
-    return npool__add(pool, str, n);
+    return atom;
+}
+const char* npool_add(Null_Pool* npool, const char* str, const size_t n)
+{
+    const atom_t atom = npool_intern(npool, str, n);
+    return (atom == ATOM_NONE) ? NULL : npool_str(npool, atom);
 }
 void npool_print(const Null_Pool* npool)
 {
@@ -178,13 +337,250 @@ void npool_print(const Null_Pool* npool)
         ASSERT(npool != NULL);
     }
 
-    size_t j = 0;
-    list_foreach(Pool * pool, npool->pools)
-    {
-        for ( size_t i = 0; i < pool->pivot; i++ ) {
-            const char* str = pool_get(pool, i);
-            printf("%02zu:%03zu: \"%s\"\n", j, i, str);
-            i += strlen(str);
+    for ( size_t i = 0; i < npool->count; i++ ) {
+        const Atom* atom = &npool->atoms[i];
+        printf("%03zu: %08x \"%s\"\n", i, atom->hash, atom->str);
+    }
+}
+
+/*****************************************************************************/
+
+// NOTE: atom id := chunk << SHARED_CHUNK_BITS | slot in chunk
+#define SHARED_CHUNK_BITS  12
+#define SHARED_CHUNK_SIZE  ((size_t)1 << SHARED_CHUNK_BITS)
+#define SHARED_CHUNKS      ((size_t)1 << 12)
+#define SHARED_SHARD_SIZE  (IDENTIFIER_POOL_SIZE / 4)
+#define SHARED_ARENA_BLOCK (1 << 16)
+
+STATIC_ASSERT((SHARED_POOL_SHARDS & (SHARED_POOL_SHARDS - 1)) == 0,
+    "SHARED_POOL_SHARDS must be a power of 2");
+
+struct Shard_Index_s {
+    SIGN_CONTRACT_LL(node);
+    size_t cap;
+    uint32_t slots[]; // atomic, id + 1 (0 is empty)
+};
+VALIDATE_CONTRACT_LL(Shard_Index, node)
+
+static Shard_Index* shard_index_new(size_t cap)
+{
+    const size_t size = sizeof(Shard_Index) + sizeof(uint32_t) * cap;
+    Shard_Index* index = mem_calloc(MEM_POOLS, 1, size);
+    if ( index == NULL ) { return NULL; }
+    index->cap = cap;
+    return index;
+}
+static Shared_Shard* shpool_shard(const Shared_Pool* shpool, uint32_t hash)
+{
+    // NOTE: high bits pick the shard, low bits the slot
+    const size_t shard = (hash >> 16) & (SHARED_POOL_SHARDS - 1);
+    return (Shared_Shard*)&shpool->shards[shard];
+}
+
+int shpool_init(Shared_Pool* shpool)
+{
+    { // sanity check
+        ASSERT(shpool != NULL);
+    }
+
+    memset(shpool, 0, sizeof(Shared_Pool));
+    list_init(&shpool->arenas);
+    pthread_mutex_init(&shpool->lock, NULL);
+    shpool->chunks = mem_calloc(MEM_POOLS, SHARED_CHUNKS, sizeof(Atom*));
+    if ( shpool->chunks == NULL ) { return false; }
+
+    for ( size_t i = 0; i < SHARED_POOL_SHARDS; i++ ) {
+        Shared_Shard* shard = &shpool->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        list_init(&shard->retired);
+        shard->index = shard_index_new(SHARED_SHARD_SIZE);
+        if ( shard->index == NULL ) { return false; }
+    }
+    return true;
+}
+void shpool_free(Shared_Pool* shpool)
+{
+    for ( size_t i = 0; i < SHARED_POOL_SHARDS; i++ ) {
+        Shared_Shard* shard = &shpool->shards[i];
+        pthread_mutex_destroy(&shard->lock);
+        list_free(&shard->retired);
+        mem_free(shard->index);
+        shard->index = NULL;
+    }
+    if ( shpool->chunks != NULL ) {
+        for ( size_t i = 0; i < SHARED_CHUNKS; i++ ) {
+            mem_free(shpool->chunks[i]);
         }
+        mem_free(shpool->chunks);
+        shpool->chunks = NULL;
+    }
+
+    List_Node* node = shpool->arenas.head;
+    while ( node != NULL ) {
+        Shared_Arena* arena = (void*)node;
+        node = node->next;
+        list_free(&arena->pools);
+        mem_free(arena);
+    }
+    list_init(&shpool->arenas);
+    pthread_mutex_destroy(&shpool->lock);
+}
+// one per thread, owned by the pool
+Shared_Arena* shpool_arena(Shared_Pool* shpool)
+{
+    { // sanity check
+        ASSERT(shpool != NULL);
     }
+
+    Shared_Arena* arena = list_node_new(MEM_POOLS, sizeof(Shared_Arena));
+    if ( arena == NULL ) { return NULL; }
+    arena->node.next = NULL;
+    list_init(&arena->pools);
+
+    pthread_mutex_lock(&shpool->lock);
+    list_push(&shpool->arenas, (void*)arena);
+    pthread_mutex_unlock(&shpool->lock);
+    return arena;
+}
+const Atom* shpool_atom(const Shared_Pool* shpool, atom_t atom)
+{
+    const Atom* chunk = __atomic_load_n(
+        &shpool->chunks[atom >> SHARED_CHUNK_BITS], __ATOMIC_ACQUIRE);
+    return &chunk[atom & (SHARED_CHUNK_SIZE - 1)];
+}
+// probe without locking, on a miss *slot is the first empty slot of index
+static atom_t shard_probe(const Shared_Pool* shpool, const Shard_Index* index,
+    uint32_t hash, const char* str, size_t n, size_t* slot)
+{
+    const size_t mask = index->cap - 1;
+    size_t i = hash & mask;
+    for ( ;; i = (i + 1) & mask ) {
+        const uint32_t id = __atomic_load_n(&index->slots[i], __ATOMIC_ACQUIRE);
+        if ( id == 0 ) { break; }
+
+        const Atom* entry = shpool_atom(shpool, id - 1);
+        if ( entry->hash == hash && entry->len == n
+            && memcmp(entry->str, str, n) == 0 ) {
+            return id - 1;
+        }
+    }
+    if ( slot != NULL ) { *slot = i; }
+    return ATOM_NONE;
+}
+atom_t shpool_find(const Shared_Pool* shpool, const char* str, size_t n)
+{
+    { // sanity check
+        ASSERT(shpool != NULL);
+        ASSERT(str != NULL);
+    }
+
+    const uint32_t hash = pool_hash(str, n);
+    const Shared_Shard* shard = shpool_shard(shpool, hash);
+    const Shard_Index* index = __atomic_load_n(&shard->index, __ATOMIC_ACQUIRE);
+    return shard_probe(shpool, index, hash, str, n, NULL);
+}
+static Atom* shpool_chunk(Shared_Pool* shpool, atom_t atom)
+{
+    Atom** ptr = &shpool->chunks[atom >> SHARED_CHUNK_BITS];
+    Atom* chunk = __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+    if ( chunk != NULL ) { return chunk; }
+
+    // NOTE: ids of a chunk are handed out to several shards, whoever gets
+    //       there first installs it
+    Atom* expected = NULL;
+    chunk = mem_alloc(MEM_POOLS, sizeof(Atom) * SHARED_CHUNK_SIZE);
+    if ( chunk == NULL ) { return NULL; }
+    if ( !__atomic_compare_exchange_n(ptr, &expected, chunk, false,
+             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) {
+        mem_free(chunk);
+        chunk = expected;
+    }
+    return chunk;
+}
+// called with the shard lock held
+static int shard_grow(Shared_Pool* shpool, Shared_Shard* shard)
+{
+    Shard_Index* old = shard->index;
+    Shard_Index* index = shard_index_new(old->cap * 2);
+    if ( index == NULL ) { return false; }
+
+    const size_t mask = index->cap - 1;
+    for ( size_t i = 0; i < old->cap; i++ ) {
+        const uint32_t id = old->slots[i];
+        if ( id == 0 ) { continue; }
+
+        size_t j = shpool_atom(shpool, id - 1)->hash & mask;
+        while ( index->slots[j] != 0 ) { j = (j + 1) & mask; }
+        index->slots[j] = id;
+    }
+
+    __atomic_store_n(&shard->index, index, __ATOMIC_RELEASE);
+    list_push(&shard->retired, (void*)old);
+    return true;
+}
+static const char* arena_add(Shared_Arena* arena, const char* str, size_t n)
+{
+    const size_t N = n + 1;
+    Pool* pool = (Pool*)arena->pools.tail;
+    if ( pool == NULL || pool->capacity < pool->pivot + N ) {
+        const size_t size = (SHARED_ARENA_BLOCK < N) ? N : SHARED_ARENA_BLOCK;
+        pool = pool_new(NULL, size);
+        if ( pool == NULL ) { return NULL; }
+        list_push(&arena->pools, (void*)pool);
+    }
+    return npool__add(pool, str, n);
+}
+// called with the shard lock held
+static atom_t shard_insert(Shared_Pool* shpool, Shared_Shard* shard,
+    Shared_Arena* arena, uint32_t hash, const char* str, size_t n)
+{
+    // NOTE: someone may have inserted it (or grown the index) meanwhile
+    size_t slot;
+    Shard_Index* index = shard->index;
+    atom_t atom = shard_probe(shpool, index, hash, str, n, &slot);
+    if ( atom != ATOM_NONE ) { return atom; }
+
+    atom = __atomic_fetch_add(&shpool->count, 1, __ATOMIC_RELAXED);
+    if ( SHARED_CHUNKS * SHARED_CHUNK_SIZE <= atom ) { return ATOM_NONE; }
+    Atom* chunk = shpool_chunk(shpool, atom);
+    const char* ptr = arena_add(arena, str, n);
+    if ( chunk == NULL || ptr == NULL ) { return ATOM_NONE; }
+
+    chunk[atom & (SHARED_CHUNK_SIZE - 1)] = (Atom) {
+        .hash = hash,
+        .len = (uint32_t)n,
+        .str = ptr,
+    };
+    // publish, readers that see the slot see the atom too
+    __atomic_store_n(&index->slots[slot], atom + 1, __ATOMIC_RELEASE);
+
+    if ( index->cap < ++shard->count * 2 && !shard_grow(shpool, shard) ) {
+        return ATOM_NONE;
+    }
+    return atom;
+}
+atom_t shpool_intern(
+    Shared_Pool* shpool, Shared_Arena* arena, const char* str, size_t n)
+{
+    { // sanity check
+        ASSERT(shpool != NULL);
+        ASSERT(arena != NULL);
+        ASSERT(str != NULL);
+        ASSERT(n <= UINT32_MAX);
+    }
+
+    const uint32_t hash = pool_hash(str, n);
+    Shared_Shard* shard = shpool_shard(shpool, hash);
+
+    { // fast path, no lock
+        const Shard_Index* index
+            = __atomic_load_n(&shard->index, __ATOMIC_ACQUIRE);
+        const atom_t atom = shard_probe(shpool, index, hash, str, n, NULL);
+        if ( atom != ATOM_NONE ) { return atom; }
+    }
+
+    pthread_mutex_lock(&shard->lock);
+    const atom_t atom = shard_insert(shpool, shard, arena, hash, str, n);
+    pthread_mutex_unlock(&shard->lock);
+    return atom;
 }
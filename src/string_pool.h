@@ -1,29 +1,122 @@
 #ifndef _STRING_POOL_H
 #define _STRING_POOL_H
 
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 
+#include "config.h"
 #include "utils.h"
 
 
+typedef struct Span_String_s Span_String;
+typedef struct Span_Entry_s {
+    uint32_t hash;
+    uint32_t id; // id + 1, 0 is an empty slot
+} Span_Entry;
 typedef struct Span_Pool_s {
-    List pools;
-}Span_Pool;
+    List pools; // NOTE: bump arena, only pools.tail can have room left
+    Context* ctx; // where the pool blocks come from, NULL for malloc
+    // every stored string in insertion order, strings[span->id] == span
+    size_t count;
+    size_t cap;
+    Span_String** strings;
+    // NOTE: with dedup identical literals share one Span_String, the index
+    //       works like the Null_Pool one (linear probing, half load).
+    int dedup;
+    size_t index_cap;
+    Span_Entry* index;
+} Span_Pool;
+// NOTE: identifiers are interned into dense ids (atoms), handed out in order
+//       of first appearance, so later passes can use plain arrays indexed
+//       by atom instead of pointer keyed maps.
+typedef uint32_t atom_t;
+#define ATOM_NONE ((atom_t)-1)
+
+typedef struct Atom_s {
+    uint32_t hash;
+    uint32_t len;
+    const char* str; // '\0' terminated, never moves
+} Atom;
 typedef struct Null_Pool_s {
     List pools;
+    Context* ctx; // where the pool blocks come from, NULL for malloc
+    // atoms[id], the side table from an atom back to its text and hash
+    size_t count;
+    size_t cap;
+    Atom* atoms;
+    // NOTE: open addressing (linear probing) index over the atoms, slots hold
+    //       id + 1 (0 is empty), index_cap is a power of 2 and at most half
+    //       of it is used.
+    size_t index_cap;
+    uint32_t* index;
 } Null_Pool;
 
-typedef struct Span_String_s {
+struct Span_String_s {
     size_t size;
+    size_t id;
     const char str[];
-} Span_String;
+};
+
+// NOTE: concurrent identifier interner, one table shared by every thread so
+//       atoms compare equal across files compiled in parallel.
+//           - lookups never lock: slots are published with release stores
+//             after the Atom they point to is written.
+//           - inserts lock one of SHARED_POOL_SHARDS shards (picked by the
+//             high hash bits), each shard has its own index that grows under
+//             that lock. replaced indices are kept until shpool_free since
+//             readers may still be probing them.
+//           - atoms live in fixed chunks that never move, ids are dense but
+//             their order depends on the thread interleaving.
+//           - strings are copied into the caller's Shared_Arena, one per
+//             thread, so the bytes are bump allocated without contention.
+typedef struct Shard_Index_s Shard_Index;
+typedef struct Shared_Shard_s {
+    pthread_mutex_t lock;
+    Shard_Index* index; // atomic
+    size_t count;
+    List retired;
+    char pad[64]; // NOTE: keep shards off each other's cache lines
+} Shared_Shard;
+typedef struct Shared_Arena_s {
+    SIGN_CONTRACT_LL(node);
+    List pools;
+} Shared_Arena;
+VALIDATE_CONTRACT_LL(Shared_Arena, node)
+typedef struct Shared_Pool_s {
+    Shared_Shard shards[SHARED_POOL_SHARDS];
+    size_t count; // atomic, next atom
+    Atom** chunks; // atomic entries
+    pthread_mutex_t lock; // arenas
+    List arenas;
+} Shared_Pool;
 
-extern int spool_init(Span_Pool* spool);
+extern int spool_init(Span_Pool* spool, Context* ctx);
+extern void spool_free(Span_Pool* spool);
 extern Span_String* spool_add(Span_Pool* spool, const char* str, size_t n);
 extern void spool_print(const Span_Pool* spool);
 
-extern int npool_init(Null_Pool* npool);
+extern int npool_init(Null_Pool* npool, Context* ctx);
+extern void npool_free(Null_Pool* npool);
+extern atom_t npool_intern(Null_Pool* npool, const char* str, size_t n);
 extern const char* npool_add(Null_Pool* npool, const char* str, size_t n);
 extern void npool_print(const Null_Pool* npool);
 
+extern int shpool_init(Shared_Pool* shpool);
+extern void shpool_free(Shared_Pool* shpool);
+extern Shared_Arena* shpool_arena(Shared_Pool* shpool);
+extern atom_t shpool_find(const Shared_Pool* shpool, const char* str, size_t n);
+extern atom_t shpool_intern(
+    Shared_Pool* shpool, Shared_Arena* arena, const char* str, size_t n);
+extern const Atom* shpool_atom(const Shared_Pool* shpool, atom_t atom);
+
+static inline const Atom* npool_atom(const Null_Pool* npool, atom_t atom)
+{
+    return &npool->atoms[atom];
+}
+static inline const char* npool_str(const Null_Pool* npool, atom_t atom)
+{
+    return npool->atoms[atom].str;
+}
+
 #endif // !_STRING_POOL_H
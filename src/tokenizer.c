@@ -1,11 +1,13 @@
 
-#include <ctype.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "scanner.h"
+#include "simd.h"
 #include "string_pool.h"
 #include "tokenizer.h"
 #include "utils.h"
@@ -88,22 +90,54 @@ const char* reps[] = {
 
 /*****************************************************************************/
 
-int match_str(const char* str, const char* buf)
-{
-    return strncmp(str, buf, strlen(str)) == 0;
-}
-int skip_space(Tokenizer0* tok)
-{
-    Line* line = scanner_peek(&tok->scanner);
-    Location* loc = &tok->loc;
-    do {
-        if ( !isspace(line->data[loc->col]) ) { return 0; }
-    } while ( ++loc->col < line->len );
-    loc->row++;
-    loc->col = 0;
-    scanner_next(&tok->scanner);
-    return 1;
-}
+/*****************************************************************************/
+
+// NOTE: every byte is classified once through char_class and tok_next jumps
+//       straight to the matching lexer state, no locale dependent ctype calls.
+typedef enum {
+    CLASS_ILLEGAL = 0, // anything else, including every non ascii byte
+    CLASS_SPACE,       // ' ', '\t', '\n', '\v', '\f', '\r'
+    CLASS_IDENT,       // [a-zA-Z_]
+    CLASS_DIGIT,       // [0-9]
+    CLASS_QUOTE,       // '"'
+    CLASS_SLASH,       // '/', a symbol or the start of a "//" comment
+    CLASS_OP,          // symbols that may start a compound symbol: -<>=!+
+    CLASS_PUNCT,       // any other single char symbol
+} char_class_t;
+
+#define XX CLASS_ILLEGAL
+#define SP CLASS_SPACE
+#define ID CLASS_IDENT
+#define DG CLASS_DIGIT
+#define QT CLASS_QUOTE
+#define SL CLASS_SLASH
+#define OP CLASS_OP
+#define PU CLASS_PUNCT
+static const unsigned char char_class[256] = {
+    /*       0   1   2   3   4   5   6   7   8   9   a   b   c   d   e   f */
+    /* 0_ */ XX, XX, XX, XX, XX, XX, XX, XX, XX, SP, SP, SP, SP, SP, XX, XX,
+    /* 1_ */ XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    /* 2_ */ SP, OP, QT, PU, PU, PU, PU, PU, PU, PU, PU, OP, PU, OP, PU, SL,
+    /* 3_ */ DG, DG, DG, DG, DG, DG, DG, DG, DG, DG, PU, PU, OP, OP, OP, PU,
+    /* 4_ */ PU, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID,
+    /* 5_ */ ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, PU, PU, PU, PU, ID,
+    /* 6_ */ PU, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID,
+    /* 7_ */ ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, PU, PU, PU, PU, XX,
+    // 0x80 - 0xff: XX, zero initialized
+};
+#undef XX
+#undef SP
+#undef ID
+#undef DG
+#undef QT
+#undef SL
+#undef OP
+#undef PU
+
+#define CHAR_CLASS(c) ((char_class_t)char_class[(unsigned char)(c)])
+
+/*****************************************************************************/
+
 void skip_line(Tokenizer0* tok)
 {
     tok->loc.row++;
@@ -111,123 +145,133 @@ void skip_line(Tokenizer0* tok)
     scanner_next(&tok->scanner);
 }
 
-int catch_symbol(Tokenizer0* tok, Token* token)
+// NOTE: perfect hash over the keyword set, the length and the first char (the
+//       second one for "else"/"enum") pick the only possible candidate, then
+//       a single compare of the whole word decides.
+static token_t tok_keyword(const char* str, size_t n)
 {
-    Line* line = scanner_peek(&tok->scanner);
-
-    const char* str = &line->data[tok->loc.col];
-    if ( !ispunct((unsigned char)*str) ) { return false; }
-
-    const size_t len = line->len - tok->loc.col;
-    for ( int i = TOK__COMPOUND_START; i < TOK__COMPOUND_END; i++ ) {
-        if ( strncmp(str, reps[i], len) == 0 ) {
-            token->type = i;
-            token->rep.str = reps[i];
-            token->loc = tok->loc;
-            tok->loc.col += strlen(reps[i]);
-            return true;
-        }
+#define KEYWORD(type) \
+    ((memcmp(str, reps[type], n) == 0) ? (type) : TOK_IDENTIFIER)
+    switch ( n ) {
+        case 2:
+            if ( str[0] == 'i' ) { return KEYWORD(TOK_KEYWORD_IF); }
+            break;
+        case 3:
+            switch ( str[0] ) {
+                case 'f': return KEYWORD(TOK_KEYWORD_FOR);
+                case 'i': return KEYWORD(TOK_KEYWORD_INT);
+                case 'r': return KEYWORD(TOK_KEYWORD_RET);
+            }
+            break;
+        case 4:
+            switch ( str[0] ) {
+                case 'b': return KEYWORD(TOK_KEYWORD_BLOB);
+                case 'c': return KEYWORD(TOK_KEYWORD_CHAR);
+                case 'e':
+                    return (str[1] == 'l') ? KEYWORD(TOK_KEYWORD_ELSE)
+                                           : KEYWORD(TOK_KEYWORD_ENUM);
+                case 'f': return KEYWORD(TOK_KEYWORD_FUNC);
+                case 'p': return KEYWORD(TOK_KEYWORD_PROC);
+                case 'v': return KEYWORD(TOK_KEYWORD_VOID);
+            }
+            break;
+        case 5:
+            switch ( str[0] ) {
+                case 'b': return KEYWORD(TOK_KEYWORD_BREAK);
+                case 'c': return KEYWORD(TOK_KEYWORD_CONST);
+                case 'f': return KEYWORD(TOK_KEYWORD_FLOAT);
+                case 'w': return KEYWORD(TOK_KEYWORD_WHILE);
+            }
+            break;
+        case 6:
+            if ( str[0] == 's' ) { return KEYWORD(TOK_KEYWORD_STRUCT); }
+            break;
+        case 8:
+            if ( str[0] == 'c' ) { return KEYWORD(TOK_KEYWORD_CONTINUE); }
+            break;
     }
-
-    token->type = (token_t)*str;
-    token->rep.c = *str;
-    token->loc = tok->loc;
-    tok->loc.col++;
-    return true;
+    return TOK_IDENTIFIER;
+#undef KEYWORD
 }
-int catch_number(Tokenizer0* tok, Token* token)
+// identifiers and keywords, the whole word is scanned first so keywords are
+// only matched on word boundaries ("iffy" is an identifier). returns 0 if the
+// identifier couldn't be interned
+static size_t lex_identifier(
+    const char* str, size_t len, Token* token, Null_Pool* identifiers)
 {
-    Line* line = scanner_peek(&tok->scanner);
+    const size_t i = 1 + simd_ident_end(str + 1, len - 1);
 
-    const char* str = &line->data[tok->loc.col];
-    unsigned char c = *str;
-    if ( !isdigit(c) ) { return false; }
+    // NOTE: a lone '_' is a symbol, "_foo" an identifier
+    if ( i == 1 && str[0] == '_' ) {
+        token->type = TOK_UNDERSCORE;
+        token->rep.c = '_';
+        return 1;
+    }
 
+    token->type = tok_keyword(str, i);
+    if ( token->type == TOK_IDENTIFIER ) {
+        token->atom = npool_intern(identifiers, str, i);
+        if ( token->atom == ATOM_NONE ) { return 0; }
+        token->rep.str = npool_str(identifiers, token->atom);
+    } else {
+        token->rep.str = reps[token->type];
+    }
+    return i;
+}
+static size_t lex_number(const char* str, size_t len, Token* token)
+{
     size_t i = 0, val = 0;
     do {
         val = val * 10 + (str[i] - '0'); // TODO: warn overflow
         i++;
-    } while ( isdigit(str[i]) );
+    } while ( i < len && CHAR_CLASS(str[i]) == CLASS_DIGIT );
 
     token->type = TOK_INTEGER;
-    token->loc = tok->loc;
-    tok->loc.col += i;
     token->rep.num = val;
-
-    return true;
-}
-int catch_identifier(Tokenizer0* tok, Token* token, Null_Pool* identifiers)
-{
-    Line* line = scanner_peek(&tok->scanner);
-
-    const char* str = &line->data[tok->loc.col];
-    unsigned char c = *str;
-    if ( !isalpha(c) && c != '_' ) { return false; }
-
-    size_t i = 1;
-    while ( isalnum(str[i]) || str[i] == '_' ) { i++; }
-
-    token->type = TOK_IDENTIFIER;
-    token->loc = tok->loc;
-    token->rep.str = npool_add(identifiers, str, i);
-
-    tok->loc.col += i;
-
-    return true;
+    return i;
 }
-int catch_keyword(Tokenizer0* tok, Token* token)
+// symbols, compound ones are matched in one step on the (first, second) pair
+static size_t lex_symbol(const char* str, size_t len, Token* token)
 {
-    Line* line = scanner_peek(&tok->scanner);
-
-    const char* str = &line->data[tok->loc.col];
-    if ( !isalpha((unsigned char)*str) ) { return false; }
-
-    for ( int i = TOK__KEYWORD_START; i < TOK__KEYWORD_END; i++ ) {
-        const size_t len = strlen(reps[i]);
-
-        if ( strncmp(str, reps[i], len) == 0 ) {
-            token->type = i;
-            token->rep.str = reps[i];
-            token->loc = tok->loc;
-            tok->loc.col += len;
-            return true;
+#define PAIR(a, b) (((unsigned)(unsigned char)(a) << 8) | (unsigned char)(b))
+    if ( CHAR_CLASS(str[0]) == CLASS_OP && 1 < len ) {
+        token_t type = TOK_ILLEGAL;
+        switch ( PAIR(str[0], str[1]) ) {
+            case PAIR('-', '>'): type = TOK_COMPOUND_ARROW; break;
+            case PAIR('<', '<'): type = TOK_COMPOUND_LSHIFT; break;
+            case PAIR('>', '>'): type = TOK_COMPOUND_RSHIFT; break;
+            case PAIR('=', '='): type = TOK_COMPOUND_EQ; break;
+            case PAIR('<', '='): type = TOK_COMPOUND_LE; break;
+            case PAIR('>', '='): type = TOK_COMPOUND_GE; break;
+            case PAIR('!', '='): type = TOK_COMPOUND_NE; break;
+            case PAIR('+', '+'): type = TOK_COMPOUND_INC; break;
+            case PAIR('-', '-'): type = TOK_COMPOUND_DEC; break;
+        }
+        if ( type != TOK_ILLEGAL ) {
+            token->type = type;
+            token->rep.str = reps[type];
+            return 2;
         }
     }
-    return false;
+#undef PAIR
+
+    token->type = (token_t)str[0];
+    token->rep.c = str[0];
+    return 1;
 }
-int catch_string(Tokenizer0* tok, Token* token, Span_Pool* strings)
+// strings can't span lines, returns 0 if it is not closed
+static size_t lex_string(
+    const char* str, size_t len, Token* token, Span_Pool* strings)
 {
-    Line* line = scanner_peek(&tok->scanner);
-
-    const char* str = &line->data[tok->loc.col];
-    if ( str[0] != '"' ) { return false; }
-
-    size_t i = 2;
-    while ( str[i] != '"' ) {
-        if ( str[i] == '\\' ) {
-            i += 2;
-        } else {
-            i++;
-        }
-        if ( line->len <= i ) {
-            LOG_ERRF("%s:%zu:%zu: string not closed", tok->loc.file_name,
-                tok->loc.row, tok->loc.col);
-            token->type = TOK_ILLEGAL;
-            token->loc = tok->loc;
-            skip_line(tok);
-            return true;
-        }
-    }
+    size_t i = 1;
+    while ( i < len && str[i] != '"' ) { i += (str[i] == '\\') ? 2 : 1; }
+    if ( len <= i ) { return 0; }
 
     token->type = TOK_STRING;
-    token->loc = tok->loc;
     // TODO: scape
-    // TODO check for offsets (-2?)
     token->rep.span = spool_add(strings, str + 1, i - 1);
 
-    tok->loc.col += i;
-
-    return true;
+    return i + 1;
 }
 
 int tok_next(
@@ -240,40 +284,77 @@ int tok_next(
         ASSERT(strings != NULL);
     }
 
-    Line* current = scanner_peek(&tok->scanner);
+    Line* current;
     while ( (current = scanner_peek(&tok->scanner)) != NULL ) {
-        if ( skip_space(tok) ) { continue; }
-
-        printf(
-            "TOKENIZER %zu:%zu\n%s", tok->loc.row, tok->loc.col, current->data);
-
-        if ( match_str("//", &current->data[tok->loc.col]) ) {
+        const char* const data = current->data;
+        size_t col = tok->loc.col;
+        col += simd_skip_space(&data[col], current->len - col);
+        if ( col == current->len ) {
             skip_line(tok);
             continue;
         }
-
-        // NOTE: '_' counts as a symbol or a identifier... depends on the order
-        //       we try to catch it.
-        // NOTE: first check keywords or they will count ass identifiers
-        if ( !(catch_keyword(tok, token) || catch_symbol(tok, token)
-                 || catch_identifier(tok, token, identifiers)
-                 || catch_number(tok, token)
-                 || catch_string(tok, token, strings)) ) {
-            token->loc = tok->loc;
-            token->type = TOK_ILLEGAL;
-            token->rep.str = reps[TOK_ILLEGAL];
+        tok->loc.col = col;
+
+        const char* str = &current->data[col];
+        const size_t len = current->len - col;
+
+        LOG_TRACEF(LOG_TOKENIZER, "%zu:%zu: %.*s", tok->loc.row, tok->loc.col,
+            (int)(line_trim_len(current) - col), str);
+
+        token->loc = tok->loc;
+
+        size_t n = 0;
+        switch ( CHAR_CLASS(*str) ) {
+            case CLASS_IDENT:
+                n = lex_identifier(str, len, token, identifiers);
+                if ( n == 0 ) {
+                    LOG_ERRF("%s:%zu:%zu: failed to intern identifier",
+                        tok->scanner.file_name, tok->loc.row, tok->loc.col);
+                    return TOKENIZER_FAIL;
+                }
+                break;
+            case CLASS_DIGIT: n = lex_number(str, len, token); break;
+            case CLASS_QUOTE:
+                n = lex_string(str, len, token, strings);
+                if ( n == 0 ) {
+                    LOG_ERRF("%s:%zu:%zu: string not closed",
+                        tok->scanner.file_name, tok->loc.row, tok->loc.col);
+                    token->type = TOK_ILLEGAL;
+                    token->rep.c = '"';
+                    skip_line(tok);
+                    return TOKENIZER_SUCCESS;
+                }
+                break;
+            case CLASS_SLASH:
+                if ( 1 < len && str[1] == '/' ) { // comment
+                    skip_line(tok);
+                    continue;
+                }
+                n = lex_symbol(str, len, token);
+                break;
+            case CLASS_OP:
+            case CLASS_PUNCT: n = lex_symbol(str, len, token); break;
+            case CLASS_SPACE: UNREACHABLE("spaces are already skipped");
+            case CLASS_ILLEGAL:
+            default:
+                token->type = TOK_ILLEGAL;
+                token->rep.c = *str;
+                n = 1;
+                break;
         }
 
+        tok->loc.col += n;
         return TOKENIZER_SUCCESS;
     }
 
     token->loc = tok->loc;
     token->type = TOK_EOF;
     token->rep.str = reps[TOK_EOF];
+    if ( tok->scanner.failed ) { return TOKENIZER_FAIL; }
     return TOKENIZER_EOF;
 }
 
-int tok_init(Tokenizer0* tok, const char* file_name)
+int tok_init(Tokenizer0* tok, const char* file_name, scanner_mode_t mode)
 {
     { // sanity check
         ASSERT(tok != NULL);
@@ -284,59 +365,444 @@ int tok_init(Tokenizer0* tok, const char* file_name)
         .col = 0,
         .row = 0,
     };
-    if ( scanner_load(&tok->scanner, file_name) == SCANNER_FAIL ) {
+    int status = SCANNER_FAIL;
+    switch ( mode ) {
+        case SCANNER_MODE_LINES:
+            status = scanner_load(&tok->scanner, file_name);
+            break;
+        case SCANNER_MODE_MMAP:
+            status = scanner_mmap(&tok->scanner, file_name);
+            break;
+        case SCANNER_MODE_STREAM:
+            status = scanner_stream(&tok->scanner, file_name);
+            break;
+        default: UNREACHABLE("???");
+    }
+    if ( status == SCANNER_FAIL ) { return TOKENIZER_FAIL; }
+
+    return TOKENIZER_SUCCESS;
+}
+
+/*****************************************************************************/
+
+int tokbuf_init(Token_Buffer* buff, size_t hint)
+{
+    { // sanity check
+        ASSERT(buff != NULL);
+        ASSERT(hint != 0);
+    }
+
+    *buff = (Token_Buffer) {
+        .count = 0,
+        .cap = hint,
+        .types = mem_alloc(MEM_TOKENS, sizeof(uint8_t) * hint),
+        .offsets = mem_alloc(MEM_TOKENS, sizeof(uint32_t) * hint),
+        .payloads = mem_alloc(MEM_TOKENS, sizeof(uint32_t) * hint),
+        .value_count = 0,
+        .value_cap = hint / 4 + 1,
+        .scanner = NULL,
+        .identifiers = NULL,
+    };
+    buff->values
+        = mem_alloc(MEM_TOKENS, sizeof(Token_Value) * buff->value_cap);
+
+    if ( buff->types == NULL || buff->offsets == NULL
+        || buff->payloads == NULL || buff->values == NULL ) {
+        tokbuf_free(buff);
         return TOKENIZER_FAIL;
     }
+    return TOKENIZER_SUCCESS;
+}
+void tokbuf_free(Token_Buffer* buff)
+{
+    mem_free(buff->types);
+    mem_free(buff->offsets);
+    mem_free(buff->payloads);
+    mem_free(buff->values);
+    *buff = (Token_Buffer) { 0 };
+}
+static int tokbuf_grow(Token_Buffer* buff)
+{
+    const size_t cap = buff->cap * 2;
+    uint8_t* types
+        = mem_realloc(MEM_TOKENS, buff->types, sizeof(uint8_t) * cap);
+    if ( types == NULL ) { return TOKENIZER_FAIL; }
+    buff->types = types;
+    uint32_t* offsets
+        = mem_realloc(MEM_TOKENS, buff->offsets, sizeof(uint32_t) * cap);
+    if ( offsets == NULL ) { return TOKENIZER_FAIL; }
+    buff->offsets = offsets;
+    uint32_t* payloads
+        = mem_realloc(MEM_TOKENS, buff->payloads, sizeof(uint32_t) * cap);
+    if ( payloads == NULL ) { return TOKENIZER_FAIL; }
+    buff->payloads = payloads;
+    buff->cap = cap;
+    return TOKENIZER_SUCCESS;
+}
+static int tokbuf_push(Token_Buffer* buff, const Token* token, size_t offset)
+{
+    if ( buff->count == buff->cap && tokbuf_grow(buff) == TOKENIZER_FAIL ) {
+        return TOKENIZER_FAIL;
+    }
+
+    uint32_t payload = 0;
+    switch ( token->type ) {
+        case TOK_IDENTIFIER: payload = token->atom; break;
+        case TOK_ILLEGAL:
+        case TOK_INTEGER:
+        case TOK_STRING:
+            if ( buff->value_count == buff->value_cap ) {
+                const size_t cap = buff->value_cap * 2;
+                Token_Value* values = mem_realloc(
+                    MEM_TOKENS, buff->values, sizeof(Token_Value) * cap);
+                if ( values == NULL ) { return TOKENIZER_FAIL; }
+                buff->values = values;
+                buff->value_cap = cap;
+            }
+            payload = buff->value_count++;
+            buff->values[payload] = token->rep;
+            break;
+        default: break;
+    }
+
+    const size_t i = buff->count++;
+    buff->types[i] = token->type;
+    buff->offsets[i] = offset;
+    buff->payloads[i] = payload;
+    return TOKENIZER_SUCCESS;
+}
+int tokbuf_lex(Token_Buffer* buff, Tokenizer0* tok, Null_Pool* identifiers,
+    Span_Pool* strings)
+{
+    { // sanity check
+        ASSERT(buff != NULL);
+        ASSERT(tok != NULL);
+    }
+
+    const Scanner* scanner = &tok->scanner;
+    if ( scanner->mode != SCANNER_MODE_MMAP ) {
+        LOG_ERR("pre-tokenization needs the whole source mapped");
+        return TOKENIZER_FAIL;
+    }
+    if ( UINT32_MAX <= scanner->src_len ) {
+        LOG_ERRF("%s: too big to pre-tokenize", scanner->file_name);
+        return TOKENIZER_FAIL;
+    }
+    buff->scanner = scanner;
+    buff->identifiers = identifiers;
+
+    Token token;
+    int status;
+    do {
+        status = tok_next(tok, &token, identifiers, strings);
+        if ( status == TOKENIZER_FAIL ) { return TOKENIZER_FAIL; }
+
+        // NOTE: in mmap mode rows are line indices
+        const size_t offset = (token.type == TOK_EOF)
+            ? scanner->src_len
+            : scanner->offsets[token.loc.row] + token.loc.col;
+        if ( tokbuf_push(buff, &token, offset) == TOKENIZER_FAIL ) {
+            perror("realloc");
+            return TOKENIZER_FAIL;
+        }
+    } while ( status != TOKENIZER_EOF );
+
+    return TOKENIZER_SUCCESS;
+}
+// NOTE: comments and strings never span lines, so the source can be cut at
+//       any line boundary and every chunk lexed on its own thread. chunks are
+//       views over the shared mapping that start at their first line, rows and
+//       offsets are global. identifiers and strings go to per job pools, see
+//       tokbuf_remap for how they reach the shared ones.
+typedef struct Lex_Job_s {
+    Tokenizer0 tok;
+    Null_Pool identifiers;
+    Span_Pool strings;
+    Token_Buffer tokens;
+    int status;
+
+    // NOTE: for the merge, where the chunk goes in the shared buffer
+    atom_t* atoms; // local atom -> shared atom
+    Span_String** spans; // local string id -> shared string
+    Token_Buffer* dst;
+    size_t count; // tokens kept, the EOF of a chunk is not
+    size_t token_base;
+    size_t value_base;
+    int threaded; // copied on its own thread
+} Lex_Job;
+
+static void* tokbuf_lex_job(void* arg)
+{
+    Lex_Job* job = arg;
+    job->status = tokbuf_lex(
+        &job->tokens, &job->tok, &job->identifiers, &job->strings);
+    return NULL;
+}
+// NOTE: the only serial part of the merge, over the unique identifiers and
+//       strings of each chunk. locals are interned in their own order and
+//       the chunks in source order, so the shared ids come out in order of
+//       first appearance, same as a serial lex.
+static int tokbuf_remap(Lex_Job* job, Null_Pool* identifiers,
+    Span_Pool* strings)
+{
+    const Null_Pool* local = &job->identifiers;
+    const Span_Pool* local_strings = &job->strings;
+    job->atoms = mem_alloc(MEM_TOKENS, sizeof(atom_t) * (local->count + 1));
+    job->spans = mem_alloc(
+        MEM_TOKENS, sizeof(Span_String*) * (local_strings->count + 1));
+    if ( job->atoms == NULL || job->spans == NULL ) { return TOKENIZER_FAIL; }
+
+    for ( size_t i = 0; i < local->count; i++ ) {
+        const Atom* a = npool_atom(local, (atom_t)i);
+        job->atoms[i] = npool_intern(identifiers, a->str, a->len);
+        if ( job->atoms[i] == ATOM_NONE ) { return TOKENIZER_FAIL; }
+    }
+    for ( size_t i = 0; i < local_strings->count; i++ ) {
+        const Span_String* span = local_strings->strings[i];
+        job->spans[i] = spool_add(strings, span->str, span->size);
+        if ( job->spans[i] == NULL ) { return TOKENIZER_FAIL; }
+    }
+    return TOKENIZER_SUCCESS;
+}
+// NOTE: on the job's thread again, rewrites the payloads of its chunk in
+//       place and copies it to its slice of the shared buffer
+static void* tokbuf_copy_job(void* arg)
+{
+    Lex_Job* job = arg;
+    Token_Buffer* src = &job->tokens;
+    Token_Buffer* dst = job->dst;
+
+    for ( size_t i = 0; i < job->count; i++ ) {
+        uint32_t* payload = &src->payloads[i];
+        switch ( src->types[i] ) {
+            case TOK_IDENTIFIER: *payload = job->atoms[*payload]; break;
+            case TOK_STRING: {
+                Token_Value* value = &src->values[*payload];
+                value->span = job->spans[value->span->id];
+            } // fall through
+            case TOK_ILLEGAL:
+            case TOK_INTEGER:
+                *payload += (uint32_t)job->value_base;
+                break;
+            default: break;
+        }
+    }
+    memcpy(&dst->types[job->token_base], src->types,
+        sizeof(uint8_t) * job->count);
+    memcpy(&dst->offsets[job->token_base], src->offsets,
+        sizeof(uint32_t) * job->count);
+    memcpy(&dst->payloads[job->token_base], src->payloads,
+        sizeof(uint32_t) * job->count);
+    memcpy(&dst->values[job->value_base], src->values,
+        sizeof(Token_Value) * src->value_count);
+    return NULL;
+}
+// NOTE: every chunk gets its slice of buff up front, then the jobs copy
+//       themselves in parallel. a job that can't get a thread is copied here.
+static int tokbuf_merge(Token_Buffer* buff, Lex_Job* job, size_t jobs,
+    pthread_t* threads, Null_Pool* identifiers, Span_Pool* strings)
+{
+    size_t count = buff->count, value_count = buff->value_count;
+    for ( size_t i = 0; i < jobs; i++ ) {
+        if ( tokbuf_remap(&job[i], identifiers, strings) == TOKENIZER_FAIL ) {
+            LOG_ERR("out of memory");
+            return TOKENIZER_FAIL;
+        }
+        const Token_Buffer* src = &job[i].tokens;
+        job[i].dst = buff;
+        job[i].count = (i + 1 == jobs) ? src->count : src->count - 1;
+        job[i].token_base = count;
+        job[i].value_base = value_count;
+        count += job[i].count;
+        value_count += src->value_count;
+    }
+
+    while ( buff->cap < count ) {
+        if ( tokbuf_grow(buff) == TOKENIZER_FAIL ) {
+            perror("realloc");
+            return TOKENIZER_FAIL;
+        }
+    }
+    if ( buff->value_cap < value_count ) {
+        Token_Value* values = mem_realloc(
+            MEM_TOKENS, buff->values, sizeof(Token_Value) * value_count);
+        if ( values == NULL ) {
+            perror("realloc");
+            return TOKENIZER_FAIL;
+        }
+        buff->values = values;
+        buff->value_cap = value_count;
+    }
 
+    for ( size_t i = 1; i < jobs; i++ ) {
+        job[i].threaded
+            = pthread_create(&threads[i], NULL, tokbuf_copy_job, &job[i]) == 0;
+        if ( !job[i].threaded ) { tokbuf_copy_job(&job[i]); }
+    }
+    tokbuf_copy_job(&job[0]);
+    for ( size_t i = 1; i < jobs; i++ ) {
+        if ( job[i].threaded ) { pthread_join(threads[i], NULL); }
+    }
+    buff->count = count;
+    buff->value_count = value_count;
     return TOKENIZER_SUCCESS;
 }
+int tokbuf_lex_parallel(Token_Buffer* buff, Tokenizer0* tok,
+    Null_Pool* identifiers, Span_Pool* strings, size_t jobs)
+{
+    { // sanity check
+        ASSERT(buff != NULL);
+        ASSERT(tok != NULL);
+        ASSERT(0 < jobs);
+    }
+
+    const Scanner* scanner = &tok->scanner;
+    const size_t lines = scanner->line_count;
+    if ( lines / LEXER_MIN_CHUNK_LINES < jobs ) {
+        jobs = lines / LEXER_MIN_CHUNK_LINES;
+    }
+    if ( LEXER_MAX_JOBS < jobs ) { jobs = LEXER_MAX_JOBS; }
+    if ( jobs <= 1 || scanner->mode != SCANNER_MODE_MMAP ) {
+        return tokbuf_lex(buff, tok, identifiers, strings);
+    }
+    LOG_DEBUGF(LOG_TOKENIZER, "lexing %zu lines on %zu threads", lines, jobs);
+
+    Lex_Job* job = mem_calloc(MEM_TOKENS, jobs, sizeof(Lex_Job));
+    pthread_t* threads = mem_calloc(MEM_TOKENS, jobs, sizeof(pthread_t));
+    if ( job == NULL || threads == NULL ) {
+        perror("calloc");
+        mem_free(job);
+        mem_free(threads);
+        return TOKENIZER_FAIL;
+    }
+
+    int status = TOKENIZER_SUCCESS;
+    size_t started = 0;
+    for ( ; started < jobs; started++ ) {
+        Lex_Job* j = &job[started];
+        const size_t first = lines * started / jobs;
+        const size_t last = lines * (started + 1) / jobs;
+
+        // NOTE: a view, only reads the shared mapping and index
+        j->tok.scanner = *scanner;
+        j->tok.scanner.line_index = first;
+        j->tok.scanner.line_count = last;
+        j->tok.loc = (Location) { .row = first, .col = 0 };
+
+        if ( !npool_init(&j->identifiers, NULL)
+            || !spool_init(&j->strings, NULL)
+            || tokbuf_init(&j->tokens, TOKEN_BUFF_SIZE) == TOKENIZER_FAIL
+            || pthread_create(&threads[started], NULL, tokbuf_lex_job, j)
+                != 0 ) {
+            LOG_ERR("failed to start a lexer thread");
+            status = TOKENIZER_FAIL;
+            break;
+        }
+    }
+    for ( size_t i = 0; i < started; i++ ) {
+        pthread_join(threads[i], NULL);
+        if ( job[i].status == TOKENIZER_FAIL ) { status = TOKENIZER_FAIL; }
+    }
+
+    buff->scanner = scanner;
+    buff->identifiers = identifiers;
+    if ( status == TOKENIZER_SUCCESS ) {
+        status = tokbuf_merge(buff, job, jobs, threads, identifiers, strings);
+    }
+
+    for ( size_t i = 0; i < jobs; i++ ) {
+        npool_free(&job[i].identifiers);
+        spool_free(&job[i].strings);
+        tokbuf_free(&job[i].tokens);
+        mem_free(job[i].atoms);
+        mem_free(job[i].spans);
+    }
+    mem_free(job);
+    mem_free(threads);
+    return status;
+}
+// rep of the tokens without a payload, it only depends on the type
+void tok_fill_rep(Token* token)
+{
+    const token_t type = token->type;
+    if ( type == TOK_EOF || TOK__COMPOUND_START <= type ) {
+        token->rep.str = reps[type];
+    } else {
+        token->rep.c = (char)type;
+    }
+}
+void tokbuf_get(const Token_Buffer* buff, size_t i, Token* token)
+{
+    { // sanity check
+        ASSERT(buff != NULL);
+        ASSERT(i < buff->count);
+    }
+
+    const token_t type = buff->types[i];
+    token->type = type;
+    switch ( type ) {
+        case TOK_IDENTIFIER:
+            token->atom = buff->payloads[i];
+            token->rep.str = npool_str(buff->identifiers, token->atom);
+            break;
+        case TOK_ILLEGAL:
+        case TOK_INTEGER:
+        case TOK_STRING:
+            token->rep = buff->values[buff->payloads[i]];
+            break;
+        default: tok_fill_rep(token); break;
+    }
+    scanner_locate(buff->scanner, buff->offsets[i], &token->loc);
+}
 
 /*****************************************************************************/
 
-void tok_print(const Token* token)
+void tok_print(FILE* out, const Token* token)
 {
-    printf("%02zu:%02zu: ", token->loc.row, token->loc.col);
+    fprintf(out, "%02zu:%02zu: ", token->loc.row, token->loc.col);
     if ( TOK__COMPOUND_START <= token->type
         && token->type < TOK__COMPOUND_END ) {
-        printf("TOK_COMPOUND(%s)", token->rep.str);
+        fprintf(out, "TOK_COMPOUND(%s)", token->rep.str);
         return;
     }
     if ( TOK__KEYWORD_START <= token->type && token->type < TOK__KEYWORD_END ) {
-        printf("TOK_KEYWORD(%s)", token->rep.str);
+        fprintf(out, "TOK_KEYWORD(%s)", token->rep.str);
         return;
     }
     switch ( token->type ) {
-        case TOK_ILLEGAL: printf("TOK_ILLEGAL(%c)", token->rep.c); break;
-        case TOK_EOF:     printf("TOK_EOF()"); break;
+        case TOK_ILLEGAL: fprintf(out, "TOK_ILLEGAL(%c)", token->rep.c); break;
+        case TOK_EOF:     fprintf(out, "TOK_EOF()"); break;
         case TOK_STRING:
-            printf("TOK_STRING(\"%.*s\")", (int)token->rep.span->size,
+            fprintf(out, "TOK_STRING(\"%.*s\")", (int)token->rep.span->size,
                 token->rep.span->str);
             break;
         case TOK_IDENTIFIER:
-            printf("TOK_IDENTIFIER(%s)", token->rep.str);
+            fprintf(out, "TOK_IDENTIFIER(%s)", token->rep.str);
             break;
-        case TOK_INTEGER: printf("TOK_INTEGER(%zu)", token->rep.num); break;
-        default:          printf("TOK_SYMBOL('%c')", token->rep.c);
+        case TOK_INTEGER:
+            fprintf(out, "TOK_INTEGER(%zu)", token->rep.num);
+            break;
+        default: fprintf(out, "TOK_SYMBOL('%c')", token->rep.c);
     }
 }
-void tok_print_rep(const Token* token)
+void tok_print_rep(FILE* out, const Token* token)
 {
     if ( (TOK__COMPOUND_START <= token->type && token->type < TOK__COMPOUND_END)
         || (TOK__KEYWORD_START <= token->type
             && token->type < TOK__KEYWORD_END) ) {
-        printf("%s", token->rep.str);
+        fprintf(out, "%s", token->rep.str);
         return;
     }
     switch ( token->type ) {
-        case TOK_ILLEGAL: printf("'%c'", token->rep.c); break;
-        case TOK_EOF:     printf("EOF"); break;
+        case TOK_ILLEGAL: fprintf(out, "'%c'", token->rep.c); break;
+        case TOK_EOF:     fprintf(out, "EOF"); break;
         case TOK_STRING:
-            printf(
-                "\"%.*s\"", (int)token->rep.span->size, token->rep.span->str);
+            fprintf(out, "\"%.*s\"", (int)token->rep.span->size,
+                token->rep.span->str);
             break;
-        case TOK_IDENTIFIER: printf("%s", token->rep.str); break;
-        case TOK_INTEGER:    printf("%zu", token->rep.num); break;
-        default:             printf("'%c'", token->rep.c);
+        case TOK_IDENTIFIER: fprintf(out, "%s", token->rep.str); break;
+        case TOK_INTEGER:    fprintf(out, "%zu", token->rep.num); break;
+        default:             fprintf(out, "'%c'", token->rep.c);
     }
 }
 char* tok_get_type_rep(token_t type)
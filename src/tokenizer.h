@@ -3,6 +3,7 @@
 
 #include <ctype.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "config.h"
@@ -96,15 +97,17 @@ enum {
     TOKENIZER_EOF = -1,
 };
 
+typedef union Token_Value_u {
+    size_t num;
+    const char* str;
+    Span_String* span;
+    char c;
+} Token_Value;
+
 typedef struct Token_s {
     token_t type;
-    union {
-        size_t num;
-        void* id; // used for symbol maps
-        const char* str;
-        Span_String* span;
-        char c;
-    } rep;
+    atom_t atom; // TOK_IDENTIFIER only, rep.str is its text
+    Token_Value rep;
     Location loc;
 } Token;
 
@@ -113,13 +116,46 @@ typedef struct Tokenizer0_s {
     Scanner scanner;
 } Tokenizer0;
 
+// NOTE: the whole file lexed up front into parallel arrays (structure of
+//       arrays), token i is:
+//           types[i]    its token_t
+//           offsets[i]  its offset in the source, locations are resolved
+//                       through the scanner line index (SCANNER_MODE_MMAP)
+//           payloads[i] the atom of an identifier, or an index into
+//                       values for integers, strings and illegal tokens
+//       the last token is always TOK_EOF.
+typedef struct Token_Buffer_s {
+    size_t count;
+    size_t cap;
+    uint8_t* types;
+    uint32_t* offsets;
+    uint32_t* payloads;
+
+    size_t value_count;
+    size_t value_cap;
+    Token_Value* values;
+
+    const Scanner* scanner;
+    const Null_Pool* identifiers;
+} Token_Buffer;
+STATIC_ASSERT(TOK__KEYWORD_END <= UINT8_MAX, "token_t must fit in types[]");
+
 int tok_next(
     Tokenizer0* tok, Token* token, Null_Pool* identifiers, Span_Pool* strings);
-int tok_init(Tokenizer0* tok, const char* file_name);
+int tok_init(Tokenizer0* tok, const char* file_name, scanner_mode_t mode);
+
+extern int tokbuf_init(Token_Buffer* buff, size_t hint);
+extern void tokbuf_free(Token_Buffer* buff);
+extern int tokbuf_lex(Token_Buffer* buff, Tokenizer0* tok,
+    Null_Pool* identifiers, Span_Pool* strings);
+extern int tokbuf_lex_parallel(Token_Buffer* buff, Tokenizer0* tok,
+    Null_Pool* identifiers, Span_Pool* strings, size_t jobs);
+extern void tokbuf_get(const Token_Buffer* buff, size_t i, Token* token);
+extern void tok_fill_rep(Token* token);
 
 // debug
-extern void tok_print(const Token* token);
-extern void tok_print_rep(const Token* token);
+extern void tok_print(FILE* out, const Token* token);
+extern void tok_print_rep(FILE* out, const Token* token);
 char* tok_get_type_rep(token_t type);
 
 #endif // !_TOKENIZER_H
@@ -1,11 +1,78 @@
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "config.h"
 #include "utils.h"
 
+/*****************************************************************************/
+/** log **********************************************************************/
+
+int log_level = LOG_LEVEL_WARN;
+unsigned log_cats = LOG_ALL;
+
+static const struct {
+    log_cat_t cat;
+    const char* name;
+} log_cat_reps[] = {
+    { LOG_MAIN, "main" },
+    { LOG_SCANNER, "scanner" },
+    { LOG_TOKENIZER, "tokenizer" },
+    { LOG_AST, "ast" },
+    { LOG_GEN, "gen" },
+    { LOG_ALL, "all" },
+};
+static const char* log_level_reps[] = {
+    [LOG_LEVEL_ERROR] = "error",
+    [LOG_LEVEL_WARN] = "warn",
+    [LOG_LEVEL_INFO] = "info",
+    [LOG_LEVEL_DEBUG] = "debug",
+    [LOG_LEVEL_TRACE] = "trace",
+};
+#define LOG_CAT_COUNT (sizeof(log_cat_reps) / sizeof(log_cat_reps[0]))
+
+int log_parse_cats(const char* list)
+{
+    { // sanity check
+        ASSERT(list != NULL);
+    }
+
+    unsigned cats = 0;
+    while ( *list != '\0' ) {
+        const char* end = strchr(list, ',');
+        const size_t len = (end != NULL) ? (size_t)(end - list) : strlen(list);
+
+        size_t i = 0;
+        for ( ; i < LOG_CAT_COUNT; i++ ) {
+            const char* name = log_cat_reps[i].name;
+            if ( strlen(name) == len && strncmp(name, list, len) == 0 ) {
+                cats |= log_cat_reps[i].cat;
+                break;
+            }
+        }
+        if ( i == LOG_CAT_COUNT ) { return -1; }
+
+        list += len + (end != NULL);
+    }
+
+    log_cats = cats;
+    return 0;
+}
+void log_prefix(int level, log_cat_t cat)
+{
+    const char* name = "?";
+    for ( size_t i = 0; i < LOG_CAT_COUNT; i++ ) {
+        if ( log_cat_reps[i].cat == cat ) {
+            name = log_cat_reps[i].name;
+            break;
+        }
+    }
+    fprintf(LOG_STREAM, "carmen:%s:%s: ", log_level_reps[level], name);
+}
+
 /*****************************************************************************/
 /** buffer *******************************************************************/
 
@@ -41,6 +108,326 @@ void buff_lshift(Buffer* const buff, const size_t offset)
     }
 }
 
+/*****************************************************************************/
+/** context ******************************************************************/
+
+STATIC_ASSERT(offsetof(Context_Block, data) % DATA_ALIGN == 0,
+    "Context_Block data must be aligned");
+
+void context_init(Context* ctx, void* blob, size_t size)
+{
+    { // sanity check
+        ASSERT(ctx != NULL);
+    }
+
+    *ctx = (Context) { .head = NULL, .block = NULL };
+
+    // NOTE: the blob holds its own block header, it has to be worth it
+    const uintptr_t addr = (uintptr_t)blob;
+    const size_t pad = DATA_ROUND_UP(addr, DATA_ALIGN) - addr;
+    if ( blob == NULL || size < pad + sizeof(Context_Block) + DATA_ALIGN ) {
+        return;
+    }
+
+    Context_Block* block = (Context_Block*)((char*)blob + pad);
+    *block = (Context_Block) {
+        .owned = 0,
+        .next = NULL,
+        .size = size - pad - sizeof(Context_Block),
+        .used = 0,
+    };
+    ctx->head = block;
+    ctx->block = block;
+}
+void context_free(Context* ctx)
+{
+    Context_Block* block = ctx->head;
+    while ( block != NULL ) {
+        Context_Block* next = block->next;
+        if ( block->owned ) { mem_free(block); }
+        block = next;
+    }
+    *ctx = (Context) { .head = NULL, .block = NULL };
+}
+static Context_Block* context_block_new(size_t size)
+{
+    if ( size < CONTEXT_BLOCK_SIZE ) { size = CONTEXT_BLOCK_SIZE; }
+    Context_Block* block
+        = mem_alloc(MEM_CONTEXT, sizeof(Context_Block) + size);
+    if ( block == NULL ) { return NULL; }
+
+    *block = (Context_Block) {
+        .owned = 1,
+        .next = NULL,
+        .size = size,
+        .used = 0,
+    };
+    return block;
+}
+void* context_alloc(Context* ctx, size_t size)
+{
+    { // sanity check
+        ASSERT(ctx != NULL);
+    }
+
+    size = DATA_ROUND_UP(size, DATA_ALIGN);
+
+    Context_Block* block = ctx->block;
+    if ( block != NULL && block->size - block->used < size ) {
+        // NOTE: reuse the next block if it fits, if not a new one goes
+        //       in between so the bigger ones stay for later
+        Context_Block* next = block->next;
+        if ( next == NULL || next->size < size ) {
+            next = context_block_new(size);
+            if ( next == NULL ) { return NULL; }
+            next->next = block->next;
+            block->next = next;
+        }
+        next->used = 0;
+        block = next;
+    } else if ( block == NULL ) {
+        block = context_block_new(size);
+        if ( block == NULL ) { return NULL; }
+        ctx->head = block;
+    }
+    ctx->block = block;
+
+    void* ptr = &block->data[block->used];
+    block->used += size;
+    return ptr;
+}
+Context_Mark context_lock(const Context* ctx)
+{
+    if ( ctx->block == NULL ) {
+        return (Context_Mark) { .block = NULL, .used = 0 };
+    }
+    return (Context_Mark) { .block = ctx->block, .used = ctx->block->used };
+}
+void context_unlock(Context* ctx, Context_Mark mark)
+{
+    if ( mark.block == NULL ) { // locked before the first block
+        ctx->block = ctx->head;
+        if ( ctx->block != NULL ) { ctx->block->used = 0; }
+        return;
+    }
+    ctx->block = mark.block;
+    ctx->block->used = mark.used;
+}
+
+/*****************************************************************************/
+/** memory *******************************************************************/
+
+// NOTE: 16 bytes so the user part keeps the malloc alignment
+typedef struct Mem_Header_s {
+    size_t size;
+    size_t cat;
+} Mem_Header;
+STATIC_ASSERT(sizeof(Mem_Header) == 16, "Mem_Header must keep the alignment");
+
+static const char* mem_cat_reps[] = {
+    [MEM_SCANNER] = "scanner",
+    [MEM_TOKENS] = "tokens",
+    [MEM_POOLS] = "pools",
+    [MEM_AST] = "ast",
+    [MEM_SYMTAB] = "symtab",
+    [MEM_GEN] = "gen",
+    [MEM_CONTEXT] = "context",
+};
+STATIC_ASSERT(sizeof(mem_cat_reps) / sizeof(mem_cat_reps[0]) == MEM_CAT_COUNT,
+    "missing mem_cat_t names");
+
+// NOTE: the workers of the parallel lexer allocate too, so the counters are
+//       only touched with atomics
+static Mem_Stats mem_cats[MEM_CAT_COUNT];
+static size_t mem_live = 0;
+static size_t mem_peak = 0;
+
+static void mem_bump_peak(size_t* peak, size_t live)
+{
+    size_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while ( old < live
+        && !__atomic_compare_exchange_n(
+            peak, &old, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) ) { }
+}
+static void mem_account(mem_cat_t cat, size_t old_size, size_t new_size)
+{
+    Mem_Stats* stats = &mem_cats[cat];
+    const size_t delta = new_size - old_size; // wraps around on a shrink
+
+    mem_bump_peak(&stats->peak,
+        __atomic_add_fetch(&stats->live, delta, __ATOMIC_RELAXED));
+    mem_bump_peak(
+        &mem_peak, __atomic_add_fetch(&mem_live, delta, __ATOMIC_RELAXED));
+}
+static void* mem_setup(Mem_Header* header, mem_cat_t cat, size_t size)
+{
+    if ( header == NULL ) { return NULL; }
+
+    header->size = size;
+    header->cat = cat;
+    __atomic_add_fetch(&mem_cats[cat].allocs, 1, __ATOMIC_RELAXED);
+    mem_account(cat, 0, size);
+    return &header[1];
+}
+void* mem_alloc(mem_cat_t cat, size_t size)
+{
+    { // sanity check
+        ASSERT(cat < MEM_CAT_COUNT);
+    }
+
+    return mem_setup(malloc(sizeof(Mem_Header) + size), cat, size);
+}
+void* mem_calloc(mem_cat_t cat, size_t count, size_t size)
+{
+    { // sanity check
+        ASSERT(cat < MEM_CAT_COUNT);
+    }
+
+    if ( size != 0 && SIZE_MAX / size - sizeof(Mem_Header) < count ) {
+        return NULL;
+    }
+    // NOTE: not mem_alloc + memset, big blocks come zeroed from the kernel
+    //       and writing them would fault in every page
+    size *= count;
+    return mem_setup(calloc(1, sizeof(Mem_Header) + size), cat, size);
+}
+void* mem_realloc(mem_cat_t cat, void* ptr, size_t size)
+{
+    if ( ptr == NULL ) { return mem_alloc(cat, size); }
+
+    Mem_Header* header = (Mem_Header*)ptr - 1;
+    { // sanity check
+        ASSERT(header->cat == cat);
+    }
+
+    const size_t old_size = header->size;
+    header = realloc(header, sizeof(Mem_Header) + size);
+    if ( header == NULL ) { return NULL; }
+
+    header->size = size;
+    __atomic_add_fetch(&mem_cats[cat].allocs, 1, __ATOMIC_RELAXED);
+    mem_account(cat, old_size, size);
+    return &header[1];
+}
+void mem_free(void* ptr)
+{
+    if ( ptr == NULL ) { return; }
+
+    Mem_Header* header = (Mem_Header*)ptr - 1;
+    { // sanity check
+        ASSERT(header->cat < MEM_CAT_COUNT);
+    }
+
+    __atomic_add_fetch(&mem_cats[header->cat].frees, 1, __ATOMIC_RELAXED);
+    mem_account(header->cat, header->size, 0);
+    free(header);
+}
+void* mem_context_alloc(Context* ctx, mem_cat_t cat, size_t size)
+{
+    { // sanity check
+        ASSERT(cat < MEM_CAT_COUNT);
+    }
+
+    void* ptr = context_alloc(ctx, size);
+    if ( ptr == NULL ) { return NULL; }
+
+    Mem_Stats* stats = &mem_cats[cat];
+    __atomic_add_fetch(&stats->ctx_allocs, 1, __ATOMIC_RELAXED);
+    mem_bump_peak(&stats->ctx_peak,
+        __atomic_add_fetch(&stats->ctx_live, size, __ATOMIC_RELAXED));
+    return ptr;
+}
+void mem_context_release(mem_cat_t cat, size_t size)
+{
+    { // sanity check
+        ASSERT(cat < MEM_CAT_COUNT);
+        ASSERT(size <= mem_cats[cat].ctx_live);
+    }
+
+    __atomic_sub_fetch(&mem_cats[cat].ctx_live, size, __ATOMIC_RELAXED);
+}
+Mem_Stats mem_stats(mem_cat_t cat)
+{
+    { // sanity check
+        ASSERT(cat < MEM_CAT_COUNT);
+    }
+
+    const Mem_Stats* stats = &mem_cats[cat];
+    return (Mem_Stats) {
+        .allocs = __atomic_load_n(&stats->allocs, __ATOMIC_RELAXED),
+        .frees = __atomic_load_n(&stats->frees, __ATOMIC_RELAXED),
+        .live = __atomic_load_n(&stats->live, __ATOMIC_RELAXED),
+        .peak = __atomic_load_n(&stats->peak, __ATOMIC_RELAXED),
+        .ctx_allocs = __atomic_load_n(&stats->ctx_allocs, __ATOMIC_RELAXED),
+        .ctx_live = __atomic_load_n(&stats->ctx_live, __ATOMIC_RELAXED),
+        .ctx_peak = __atomic_load_n(&stats->ctx_peak, __ATOMIC_RELAXED),
+    };
+}
+
+static const char* mem_fmt(char* buff, size_t size, size_t n)
+{
+    static const char units[] = "BKMG";
+    double value = (double)n;
+    size_t unit = 0;
+    while ( value >= 1024.0 && unit + 1 < sizeof(units) - 1 ) {
+        value /= 1024.0;
+        unit++;
+    }
+    if ( unit == 0 ) {
+        snprintf(buff, size, "%zuB", n);
+    } else {
+        snprintf(buff, size, "%.1f%c", value, units[unit]);
+    }
+    return buff;
+}
+void mem_report(FILE* out)
+{
+    char live[16], peak[16], ctx_live[16], ctx_peak[16];
+    const size_t heap_live = __atomic_load_n(&mem_live, __ATOMIC_RELAXED);
+    const size_t heap_peak = __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
+    size_t allocs = 0;
+
+    fprintf(out, "%-10s %8s %9s %9s %10s %9s %9s\n", "subsystem", "allocs",
+        "live", "peak", "ctx allocs", "ctx live", "ctx peak");
+    for ( size_t i = 0; i < MEM_CAT_COUNT; i++ ) {
+        const Mem_Stats stats = mem_stats(i);
+        allocs += stats.allocs;
+        fprintf(out, "%-10s %8zu %9s %9s %10zu %9s %9s\n", mem_cat_reps[i],
+            stats.allocs, mem_fmt(live, sizeof(live), stats.live),
+            mem_fmt(peak, sizeof(peak), stats.peak), stats.ctx_allocs,
+            mem_fmt(ctx_live, sizeof(ctx_live), stats.ctx_live),
+            mem_fmt(ctx_peak, sizeof(ctx_peak), stats.ctx_peak));
+    }
+    // NOTE: the peaks of the subsystems don't add up, they can happen at
+    //       different times
+    fprintf(out, "%-10s %8zu %9s %9s\n", "heap", allocs,
+        mem_fmt(live, sizeof(live), heap_live),
+        mem_fmt(peak, sizeof(peak), heap_peak));
+}
+void mem_report_json(FILE* out)
+{
+    size_t allocs = 0, frees = 0;
+
+    fprintf(out, "{\n    \"subsystems\": {\n");
+    for ( size_t i = 0; i < MEM_CAT_COUNT; i++ ) {
+        const Mem_Stats stats = mem_stats(i);
+        allocs += stats.allocs;
+        frees += stats.frees;
+        fprintf(out,
+            "        \"%s\": { \"allocs\": %zu, \"frees\": %zu, \"live\": %zu,"
+            " \"peak\": %zu, \"ctx_allocs\": %zu, \"ctx_live\": %zu,"
+            " \"ctx_peak\": %zu }%s\n",
+            mem_cat_reps[i], stats.allocs, stats.frees, stats.live, stats.peak,
+            stats.ctx_allocs, stats.ctx_live, stats.ctx_peak,
+            (i + 1 < MEM_CAT_COUNT) ? "," : "");
+    }
+    fprintf(out,
+        "    },\n    \"heap\": { \"allocs\": %zu, \"frees\": %zu,"
+        " \"live\": %zu, \"peak\": %zu }\n}\n",
+        allocs, frees, __atomic_load_n(&mem_live, __ATOMIC_RELAXED),
+        __atomic_load_n(&mem_peak, __ATOMIC_RELAXED));
+}
+
 /*****************************************************************************/
 /** list *********************************************************************/
 
@@ -59,7 +446,13 @@ void list_init(List* list)
 }
 void list_free(List* list)
 {
-    list_foreach(char* node, *list) { free(node); }
+    // NOTE: not list_foreach, it would read node->next after the free
+    List_Node* node = list->head;
+    while ( node != NULL ) {
+        List_Node* next = node->next;
+        mem_free(node);
+        node = next;
+    }
     list->tail = NULL;
     list->head = NULL;
 }
@@ -95,13 +488,14 @@ void* list_peek(const List* list, size_t offset)
     }
     return NULL;
 }
-void* list_node_new(size_t size)
+void* list_node_new(mem_cat_t cat, size_t size)
 {
     { // sanity check
         ASSERT(size >= sizeof(List_Node*));
     }
 
-    List_Node* node = malloc(size);
+    List_Node* node = mem_alloc(cat, size);
+    if ( node == NULL ) { return NULL; }
     node->next = NULL;
     return (void*)node;
 }
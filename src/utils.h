@@ -16,6 +16,88 @@
 #define LOG_MSG(msg)        fprintf(stdout, msg "\n")
 #define LOG_MSGF(fmt, ...)  fprintf(stdout, fmt "\n", __VA_ARGS__)
 
+/*****************************************************************************/
+/* [L]og *********************************************************************/
+/*****************************************************************************/
+
+// NOTE: levels above LOG_LEVEL_MAX are removed by the preprocessor, NDEBUG
+//       builds keep up to LOG_LEVEL_INFO so they do no debug I/O at all.
+//       at runtime the level is picked with -v (info), -vv (debug) and -vvv
+//       (trace) and the categories with --log=<cat>[,<cat>]*.
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN  1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+#define LOG_LEVEL_TRACE 4
+
+#ifndef LOG_LEVEL_MAX
+#    ifdef NDEBUG
+#        define LOG_LEVEL_MAX LOG_LEVEL_INFO
+#    else
+#        define LOG_LEVEL_MAX LOG_LEVEL_TRACE
+#    endif
+#endif
+
+typedef enum {
+    LOG_MAIN = 1 << 0,
+    LOG_SCANNER = 1 << 1,
+    LOG_TOKENIZER = 1 << 2,
+    LOG_AST = 1 << 3,
+    LOG_GEN = 1 << 4,
+    LOG_ALL = (1 << 5) - 1,
+} log_cat_t;
+
+extern int log_level;
+extern unsigned log_cats;
+
+#define LOG_STREAM stderr
+
+extern int log_parse_cats(const char* list);
+extern void log_prefix(int level, log_cat_t cat);
+
+#define _LOG_ENABLED(level, cat) ((level) <= log_level && (log_cats & (cat)))
+#define _LOG_PRINTF(level, cat, fmt, ...)                \
+    do {                                                 \
+        if ( _LOG_ENABLED(level, cat) ) {                \
+            log_prefix(level, cat);                      \
+            fprintf(LOG_STREAM, fmt "\n", __VA_ARGS__); \
+        }                                                \
+    } while ( 0 )
+
+// guard for multi line dumps: `if ( LOG_ENABLED(DEBUG, LOG_AST) ) { ... }`
+#define LOG_ENABLED(level, cat) _LOG_ENABLED_##level(cat)
+
+#if LOG_LEVEL_INFO <= LOG_LEVEL_MAX
+#    define _LOG_ENABLED_INFO(cat) _LOG_ENABLED(LOG_LEVEL_INFO, cat)
+#    define LOG_INFOF(cat, fmt, ...) \
+        _LOG_PRINTF(LOG_LEVEL_INFO, cat, fmt, __VA_ARGS__)
+#else
+#    define _LOG_ENABLED_INFO(cat)   0
+#    define LOG_INFOF(cat, fmt, ...) ((void)0)
+#endif
+#if LOG_LEVEL_DEBUG <= LOG_LEVEL_MAX
+#    define _LOG_ENABLED_DEBUG(cat) _LOG_ENABLED(LOG_LEVEL_DEBUG, cat)
+#    define LOG_DEBUGF(cat, fmt, ...) \
+        _LOG_PRINTF(LOG_LEVEL_DEBUG, cat, fmt, __VA_ARGS__)
+#else
+#    define _LOG_ENABLED_DEBUG(cat)   0
+#    define LOG_DEBUGF(cat, fmt, ...) ((void)0)
+#endif
+#if LOG_LEVEL_TRACE <= LOG_LEVEL_MAX
+#    define _LOG_ENABLED_TRACE(cat) _LOG_ENABLED(LOG_LEVEL_TRACE, cat)
+#    define LOG_TRACEF(cat, fmt, ...) \
+        _LOG_PRINTF(LOG_LEVEL_TRACE, cat, fmt, __VA_ARGS__)
+#else
+#    define _LOG_ENABLED_TRACE(cat)   0
+#    define LOG_TRACEF(cat, fmt, ...) ((void)0)
+#endif
+
+#define LOG_INFO(cat, msg)  LOG_INFOF(cat, "%s", msg)
+#define LOG_DEBUG(cat, msg) LOG_DEBUGF(cat, "%s", msg)
+#define LOG_TRACE(cat, msg) LOG_TRACEF(cat, "%s", msg)
+
+/*****************************************************************************/
+
 #define ASSERT           assert
 #define STATIC_ASSERT    _Static_assert
 #define UNUSED(var)      ((void)var)
@@ -48,6 +130,76 @@ typedef struct Buffer_s {
 extern Buffer* buff_init(char* const buff, const size_t size);
 extern void buff_lshift(Buffer* const buff, const size_t offset);
 
+/*****************************************************************************/
+/* [C]ontext *****************************************************************/
+/*****************************************************************************/
+
+// NOTE: chained region allocator. the first block can be caller memory (a
+//       blob on the stack), more blocks are malloc'ed when it runs out and are
+//       kept around after a reset, so a warm context never calls malloc.
+//       context_lock takes a mark, context_unlock releases everything
+//       allocated after it in O(1). nothing is freed on its own.
+typedef struct Context_Block_s Context_Block;
+struct Context_Block_s {
+    int owned; // malloc'ed by the context
+    Context_Block* next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+typedef struct Context_s {
+    Context_Block* head;
+    Context_Block* block; // current, the ones after it are empty
+} Context;
+typedef struct Context_Mark_s {
+    Context_Block* block;
+    size_t used;
+} Context_Mark;
+
+extern void context_init(Context* ctx, void* blob, size_t size);
+extern void context_free(Context* ctx);
+extern void* context_alloc(Context* ctx, size_t size);
+extern Context_Mark context_lock(const Context* ctx);
+extern void context_unlock(Context* ctx, Context_Mark mark);
+
+/*****************************************************************************/
+/* [M]emory ******************************************************************/
+/*****************************************************************************/
+
+// NOTE: every heap allocation of the compiler goes through mem_* so the live
+//       bytes, the peak and the number of allocations can be told apart per
+//       subsystem (--mem-report). heap blocks carry a small header with their
+//       size, so mem_free doesn't need it. memory carved from a Context is
+//       counted on its own (ctx_*) since the blocks behind it are already
+//       counted as MEM_CONTEXT, the owner releases it when it's dropped.
+typedef enum {
+    MEM_SCANNER,
+    MEM_TOKENS,
+    MEM_POOLS,
+    MEM_AST,
+    MEM_SYMTAB,
+    MEM_GEN,
+    MEM_CONTEXT,
+    MEM_CAT_COUNT,
+} mem_cat_t;
+
+typedef struct Mem_Stats_s {
+    size_t allocs, frees; // heap calls, reallocs count as allocs
+    size_t live, peak;    // heap bytes
+    size_t ctx_allocs;
+    size_t ctx_live, ctx_peak;
+} Mem_Stats;
+
+extern void* mem_alloc(mem_cat_t cat, size_t size);
+extern void* mem_calloc(mem_cat_t cat, size_t count, size_t size);
+extern void* mem_realloc(mem_cat_t cat, void* ptr, size_t size);
+extern void mem_free(void* ptr);
+extern void* mem_context_alloc(Context* ctx, mem_cat_t cat, size_t size);
+extern void mem_context_release(mem_cat_t cat, size_t size);
+extern Mem_Stats mem_stats(mem_cat_t cat);
+extern void mem_report(FILE* out);
+extern void mem_report_json(FILE* out);
+
 /*****************************************************************************/
 /* [L]inked [L]ist ***********************************************************/
 /*****************************************************************************/
@@ -79,6 +231,6 @@ extern void list_init(List* list);
 extern void list_free(List* list);
 extern void list_push(List* list, List_Node* node);
 extern void* list_peek(const List* list, size_t offset);
-extern void* list_node_new(size_t size);
+extern void* list_node_new(mem_cat_t cat, size_t size);
 
 #endif // !_UTILS_H